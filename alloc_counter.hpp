@@ -0,0 +1,106 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+// Counts the heap allocations made by the whole process between start() and
+// stop(). It works by replacing malloc and friends, so it must be included
+// in exactly one translation unit of an executable. The replacement is only
+// compiled in when CHECK_ALLOCS is defined (the kcf_vot_noalloc executable)
+// and only glibc is supported, otherwise supported() returns false and
+// nothing is counted.
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+
+namespace alloc_counter {
+
+static std::atomic<bool> enabled(false);
+static std::atomic<unsigned long> count(0);
+
+inline void note()
+{
+    if (enabled.load(std::memory_order_relaxed))
+        count.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void start()
+{
+    count = 0;
+    enabled = true;
+}
+
+// Returns the number of allocations since start()
+inline unsigned long stop()
+{
+    enabled = false;
+    return count;
+}
+
+#if defined(CHECK_ALLOCS) && defined(__GLIBC__)
+#define ALLOC_COUNTER_ENABLED
+#endif
+
+inline bool supported()
+{
+#ifdef ALLOC_COUNTER_ENABLED
+    return true;
+#else
+    return false;
+#endif
+}
+
+} // namespace alloc_counter
+
+#ifdef ALLOC_COUNTER_ENABLED
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) noexcept
+{
+    alloc_counter::note();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) noexcept
+{
+    alloc_counter::note();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    alloc_counter::note();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept
+{
+    alloc_counter::note();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    alloc_counter::note();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    alloc_counter::note();
+    void *p = __libc_memalign(alignment, size);
+    if (!p)
+        return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+}
+#endif
+
+#endif // ALLOC_COUNTER_HPP
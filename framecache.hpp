@@ -0,0 +1,170 @@
+#ifndef FRAMECACHE_HPP
+#define FRAMECACHE_HPP
+
+// Decoded frames of a sequence stored in one file, which is memory-mapped
+// for reading, so that benchmarks measure the tracker instead of the image
+// decoding. The file starts with a FrameCache::Header, the frames follow at
+// data_offset, each frame_stride bytes apart. A frame is a BGR image of
+// height rows, each of width * 3 bytes. The numbers are stored in the byte
+// order of the machine that wrote the file.
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class FrameCache
+{
+public:
+    struct Header {
+        char magic[8];
+        uint32_t width, height;
+        uint64_t n_frames;
+        uint64_t frame_stride;
+        uint64_t data_offset;
+    };
+
+    FrameCache() {}
+    ~FrameCache() { close(); }
+    FrameCache(const FrameCache &) = delete;
+    FrameCache &operator=(const FrameCache &) = delete;
+
+    // Returns true when the file at path starts like a frame cache
+    static bool isFrameCache(const std::string & path)
+    {
+        char magic[sizeof(Header::magic)];
+        std::ifstream file(path.c_str(), std::ios::binary);
+        return file.read(magic, sizeof(magic)) && memcmp(magic, k_magic, sizeof(magic)) == 0;
+    }
+
+    // Decodes the images listed in images (one file name per line) and
+    // writes them to path. All images must have the same size.
+    static bool write(const std::string & images, const std::string & path)
+    {
+        std::ifstream list(images.c_str());
+        if (!list.is_open()) {
+            std::cerr << "Error loading image file " << images << "!" << std::endl;
+            return false;
+        }
+        std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "Error opening output file " << path << "!" << std::endl;
+            return false;
+        }
+
+        Header header = Header();
+        memcpy(header.magic, k_magic, sizeof(header.magic));
+        header.data_offset = k_page_size;
+        std::string line;
+        cv::Mat img;
+        while (std::getline(list, line)) {
+            if (line.empty())
+                continue;
+            img = cv::imread(line, CV_LOAD_IMAGE_COLOR);
+            if (img.empty()) {
+                std::cerr << "Error loading image " << line << "!" << std::endl;
+                return false;
+            }
+            if (header.n_frames == 0) {
+                header.width = uint32_t(img.cols);
+                header.height = uint32_t(img.rows);
+                header.frame_stride = align(uint64_t(img.cols) * img.rows * 3, k_frame_alignment);
+            } else if (img.cols != int(header.width) || img.rows != int(header.height)) {
+                std::cerr << "Error: " << line << " is " << img.cols << "x" << img.rows << ", not " << header.width
+                          << "x" << header.height << " like the first image" << std::endl;
+                return false;
+            }
+
+            out.seekp(std::streamoff(header.data_offset + header.n_frames * header.frame_stride));
+            for (int row = 0; row < img.rows; ++row)
+                out.write(img.ptr<char>(row), std::streamsize(img.cols) * 3);
+            ++header.n_frames;
+        }
+        if (header.n_frames == 0) {
+            std::cerr << "Error: no images in " << images << std::endl;
+            return false;
+        }
+
+        // pad the last frame and write the header, now that n_frames is known
+        uint64_t end = header.data_offset + header.n_frames * header.frame_stride;
+        out.seekp(std::streamoff(end - 1));
+        out.put(0);
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        return bool(out);
+    }
+
+    // Maps the frame cache at path, returns false if it is not valid
+    bool open(const std::string & path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        Header header;
+        bool ok = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(header) &&
+                  pread(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header)) &&
+                  memcmp(header.magic, k_magic, sizeof(header.magic)) == 0 &&
+                  header.frame_stride >= uint64_t(header.width) * header.height * 3 &&
+                  header.data_offset + header.n_frames * header.frame_stride <= uint64_t(st.st_size);
+        if (!ok) {
+            ::close(fd);
+            std::cerr << "Error: " << path << " is not a valid frame cache" << std::endl;
+            return false;
+        }
+
+        // A private writable mapping lets the caller draw into the frames
+        // (copy on write) without changing the file.
+        void *data = mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            perror(path.c_str());
+            return false;
+        }
+        madvise(data, size_t(st.st_size), MADV_WILLNEED);
+        p_data = static_cast<uchar *>(data);
+        p_size = size_t(st.st_size);
+        p_header = header;
+        return true;
+    }
+
+    void close()
+    {
+        if (p_data)
+            munmap(p_data, p_size);
+        p_data = nullptr;
+        p_size = 0;
+        p_header = Header();
+    }
+
+    bool isOpen() const { return p_data != nullptr; }
+    size_t size() const { return size_t(p_header.n_frames); }
+
+    // Frame i as a header over the mapping, valid while the cache is open
+    cv::Mat frame(size_t i) const
+    {
+        return cv::Mat(int(p_header.height), int(p_header.width), CV_8UC3,
+                       p_data + p_header.data_offset + i * p_header.frame_stride);
+    }
+
+private:
+    static constexpr const char *k_magic = "KCFFRM1";
+    static const uint64_t k_page_size = 4096;
+    static const uint64_t k_frame_alignment = 64;
+
+    static uint64_t align(uint64_t size, uint64_t alignment) { return (size + alignment - 1) / alignment * alignment; }
+
+    uchar *p_data = nullptr;
+    size_t p_size = 0;
+    Header p_header = Header();
+};
+
+#endif // FRAMECACHE_HPP
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "kcf.h"
+
+// Checks gaussian_correlation() of the tracker, which sums the feature
+// channels in the Fourier domain and transforms one channel per scale back,
+// against the previous implementation, which transformed every feature
+// channel back and summed them per pixel with std::accumulate. The kernel
+// maps of both are compared for all FFT implementations compiled in, on the
+// spectra of random features. In BIG_BATCH builds all scales are correlated
+// at once, as in the tracker.
+
+static const unsigned num_of_feats = 44;
+static const unsigned num_of_scales = 7;
+static const double sigma = 0.5;
+static const double tolerance = 1e-4;
+
+// Kernel maps of the scales of xyf (the channel products of xf and yf),
+// stacked vertically in kernel, computed by the previous implementation
+static void correlation_per_channel(Fft &fft, ComplexMat &xyf, int width, const float *xx, float yy, cv::Mat &kernel)
+{
+    unsigned n_scales = xyf.n_scales, feats = xyf.n_channels / n_scales;
+    int height = int(xyf.rows);
+    DynMem ifft_data(size_t(width) * height * xyf.n_channels * sizeof(float));
+    cv::Mat ifft(height, width, CV_32FC(xyf.n_channels), ifft_data.hostMem());
+    fft.inverse(xyf, ifft, nullptr, nullptr);
+
+    double numel_xf = double(xyf.cols) * xyf.rows * feats;
+    for (unsigned i = 0; i < n_scales; ++i) {
+        for (int y = 0; y < height; ++y) {
+            const float *row = ifft.ptr<float>(y);
+            float *dst = kernel.ptr<float>(int(i) * height + y);
+            for (int x = 0; x < width; ++x) {
+                const float *pixel = row + x * ifft.channels() + i * feats;
+                double xy = std::accumulate(pixel, pixel + feats, 0.f) / (double(width) * height);
+                dst[x] = float(std::exp(-1. / (sigma * sigma) * std::max(0., (xx[i] + yy - 2 * xy) / numel_xf)));
+            }
+        }
+    }
+}
+
+static bool check(const std::string &what, const cv::Mat &expected, const cv::Mat &kernel)
+{
+    double diff = cv::norm(expected, kernel, cv::NORM_INF);
+    bool ok = diff <= tolerance;
+    std::cout << what << ": max. difference " << diff << (ok ? " ok" : " FAILED") << std::endl;
+    return ok;
+}
+
+int main()
+{
+    const std::vector<cv::Size> sizes = {{16, 16}, {24, 20}, {25, 30}, {45, 32}};
+    const unsigned n_scales = BIG_BATCH_MODE ? num_of_scales : 1;
+    bool ok = true;
+
+    cv::theRNG().state = 1;
+    for (const std::string &name : Fft::implementations()) {
+        for (cv::Size size : sizes) {
+            std::unique_ptr<Fft> fft(Fft::create(name));
+            fft->init(size.width, size.height, num_of_feats, num_of_scales);
+            unsigned cols = fft->spectrum_width(size.width);
+
+            // random non-negative features, like HOG
+            DynMem x_data(size.area() * num_of_feats * n_scales * sizeof(float));
+            DynMem y_data(size.area() * num_of_feats * sizeof(float));
+            cv::Mat x(size.height * num_of_feats * n_scales, size.width, CV_32F, x_data.hostMem());
+            cv::Mat y(size.height * num_of_feats, size.width, CV_32F, y_data.hostMem());
+            cv::randu(x, 0.f, 1.f);
+            cv::randu(y, 0.f, 1.f);
+            ComplexMat xf(size.height, cols, num_of_feats * n_scales, n_scales), yf(size.height, cols, num_of_feats);
+            fft->forward_window(x, xf, nullptr, nullptr);
+            fft->forward_window(y, yf, nullptr, nullptr);
+
+            DynMem xx(n_scales * sizeof(float)), yy(sizeof(float));
+            xf.sqr_norm(xx);
+            yf.sqr_norm(yy);
+
+            // the buffers of a tracker thread, as KCF_Tracker::init() creates them
+            Arena arena;
+            arena.reserve(ThreadCtx::arena_size(size, num_of_feats * n_scales, n_scales, cols));
+            ThreadCtx ctx(size, num_of_feats * n_scales, 1., n_scales, cols, arena);
+
+            std::string what = name + " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+            cv::Mat expected(size.height * n_scales, size.width, CV_32F);
+
+            ComplexMat xyf = xf.mul2(yf.conj());
+            correlation_per_channel(*fft, xyf, size.width, xx.hostMem(), yy.hostMem()[0], expected);
+            gaussian_correlation(*fft, ctx, xf, yf, sigma);
+            ok = check(what, expected, ctx.in_all) && ok;
+
+            // auto-correlation (training), one scale
+            cv::Mat expected_auto = expected.rowRange(0, size.height);
+            xyf = yf.sqr_mag();
+            correlation_per_channel(*fft, xyf, size.width, yy.hostMem(), yy.hostMem()[0], expected_auto);
+            gaussian_correlation(*fft, ctx, yf, yf, sigma, true);
+            ok = check(what + " auto", expected_auto, ctx.in_all.rowRange(0, size.height)) && ok;
+        }
+    }
+
+    std::cout << (ok ? "All kernel maps match" : "Kernel maps differ") << std::endl;
+    return ok ? 0 : 1;
+}
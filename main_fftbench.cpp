@@ -0,0 +1,44 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fft.h"
+
+// Measures the FFT implementations compiled in on typical window sizes of
+// the tracker, or on the sizes given on the command line
+int main(int argc, char *argv[])
+{
+    const unsigned num_of_feats = 44; // HOG, color and color name features
+    std::vector<unsigned> sizes = {16, 20, 24, 25, 28, 30, 32, 36, 40, 45, 48, 50, 56, 60, 64};
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cerr << "Usage: " << argv[0] << " [size...]\n"
+                      << "Prints the time of the transforms of one tracked scale (" << num_of_feats
+                      << " features) for size x size windows (in HOG cells).\n";
+            return 0;
+        }
+        sizes.clear();
+        for (int i = 1; i < argc; ++i)
+            sizes.push_back(unsigned(std::stoul(argv[i])));
+    }
+
+    std::vector<std::string> names = Fft::implementations();
+    std::vector<std::vector<double>> times(sizes.size());
+    for (size_t i = 0; i < sizes.size(); ++i)
+        for (const std::string &name : names)
+            times[i].push_back(Fft::benchmark(name, sizes[i], sizes[i], num_of_feats, 1));
+
+    std::cout << std::endl << "Milliseconds per scale:" << std::endl << std::setw(8) << "size";
+    for (const std::string &name : names)
+        std::cout << std::setw(10) << name;
+    std::cout << std::endl << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        std::cout << std::setw(8) << (std::to_string(sizes[i]) + "x" + std::to_string(sizes[i]));
+        for (double time : times[i])
+            std::cout << std::setw(10) << time * 1000;
+        std::cout << std::endl;
+    }
+    return 0;
+}
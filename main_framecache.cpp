@@ -0,0 +1,24 @@
+#include <iostream>
+
+#include "framecache.hpp"
+
+// Converts an image sequence to a frame cache, which kcf_vot accepts in
+// place of images.txt
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " <path/to/images.txt> [path/to/frames.raw]\n"
+                  << "The image names are relative to the current directory, as in kcf_vot.\n";
+        return 1;
+    }
+    std::string output = argc == 3 ? argv[2] : "frames.raw";
+    if (!FrameCache::write(argv[1], output))
+        return 1;
+
+    FrameCache cache;
+    if (!cache.open(output))
+        return 1;
+    std::cout << "Wrote " << cache.size() << " frames of " << cache.frame(0).cols << "x" << cache.frame(0).rows
+              << " to " << output << std::endl;
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gradientMex.h"
+#include "gradient_simd.h"
+
+// Measures the gradient kernels (gradient_simd.h) supported by the CPU on
+// the HOG features of typical patch sizes of the tracker, or of the sizes
+// given on the command line, and compares them with the SSE kernels
+int main(int argc, char *argv[])
+{
+    const int bin_size = 4, n_orients = 9;
+    const float clip = 0.2f;
+    std::vector<int> sizes = {64, 96, 128, 160, 192, 256};
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cerr << "Usage: " << argv[0] << " [size...]\n"
+                      << "Prints the time of the gradient and FHoG computation of size x size patches (in pixels).\n";
+            return 0;
+        }
+        sizes.clear();
+        for (int i = 1; i < argc; ++i)
+            sizes.push_back(std::stoi(argv[i]));
+    }
+
+    std::vector<const GradientKernels *> kernels = gradient_kernels_supported();
+    std::cout << "Milliseconds per patch (speedup over " << kernels[0]->name << ", max. difference):" << std::endl
+              << std::setw(8) << "size";
+    for (const GradientKernels *k : kernels)
+        std::cout << std::setw(27) << k->name;
+    std::cout << std::endl << std::fixed;
+
+    for (int size : sizes) {
+        const int h = size, w = size, hb = h / bin_size, wb = w / bin_size;
+        std::vector<float> I(h * w), M(h * w), O(h * w), H(hb * wb * (n_orients * 3 + 5)), H_sse;
+        for (float &v : I)
+            v = float(std::rand()) / RAND_MAX;
+
+        std::cout << std::setw(8) << (std::to_string(size) + "x" + std::to_string(size));
+        double time_sse = 0;
+        for (const GradientKernels *k : kernels) {
+            set_gradient_kernels(*k);
+            int iterations = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> elapsed;
+            do {
+                std::fill(H.begin(), H.end(), 0.f);
+                gradMag(I.data(), M.data(), O.data(), h, w, 1, true);
+                fhog(M.data(), O.data(), H.data(), h, w, bin_size, n_orients, -1, clip);
+                ++iterations;
+                elapsed = std::chrono::high_resolution_clock::now() - start;
+            } while (elapsed.count() < 0.2);
+            double time = elapsed.count() / iterations;
+
+            float diff = 0;
+            if (H_sse.empty()) {
+                time_sse = time;
+                H_sse = H;
+            } else {
+                for (size_t i = 0; i < H.size(); ++i)
+                    diff = std::max(diff, std::abs(H[i] - H_sse[i]));
+            }
+            std::cout << std::setw(10) << std::setprecision(3) << time * 1000 << " (" << std::setprecision(2)
+                      << time_sse / time << "x, " << std::scientific << std::setprecision(1) << diff << ")"
+                      << std::fixed;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
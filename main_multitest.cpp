@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "kcf.h"
+#include "multikcf.h"
+#include "vot.hpp"
+
+// Tracks several targets in a sequence with MultiKCF and with the same
+// number of independent KCF_Trackers, checks that the bounding boxes and
+// filter responses agree and prints how the tracking time scales with the number of threads, with
+// and without batched FFTs (MultiKCF::setFftBatch()). The targets are the
+// initial region of the sequence shifted by a few pixels.
+
+typedef std::vector<std::vector<MultiKCF::Result>> Results; // [frame][target]
+
+static std::vector<cv::Rect> targets(const cv::Rect &init_rect, unsigned n)
+{
+    std::vector<cv::Rect> rects;
+    for (unsigned i = 0; i < n; ++i) {
+        int dx = int(i % 5) - 2, dy = int(i / 5 % 5) - 2;
+        rects.push_back(init_rect + cv::Point(4 * dx, 4 * dy));
+    }
+    return rects;
+}
+
+// Difference of x and y relative to the larger of them
+static double relative_difference(double x, double y)
+{
+    double scale = std::max(std::abs(x), std::abs(y));
+    return scale > 0 ? std::abs(x - y) / scale : 0;
+}
+
+// Largest relative difference of a coordinate or size of the box or of the
+// filter response of the same target in a and b
+static double max_difference(const Results &a, const Results &b)
+{
+    double diff = 0;
+    for (size_t f = 0; f < a.size(); ++f) {
+        for (size_t i = 0; i < a[f].size(); ++i) {
+            const BBox_c &x = a[f][i].bbox, &y = b[f][i].bbox;
+            diff = std::max({diff, relative_difference(x.cx, y.cx), relative_difference(x.cy, y.cy),
+                             relative_difference(x.w, y.w), relative_difference(x.h, y.h),
+                             relative_difference(a[f][i].response, b[f][i].response)});
+        }
+    }
+    return diff;
+}
+
+// Seconds since start
+static double since(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static double track_independent(std::vector<cv::Mat> &frames, const std::vector<cv::Rect> &rects, Results &results)
+{
+    std::vector<std::unique_ptr<KCF_Tracker>> trackers;
+    for (const cv::Rect &rect : rects) {
+        trackers.emplace_back(new KCF_Tracker());
+        // one thread, like the trackers of MultiKCF
+        trackers.back()->m_use_multithreading = false;
+        trackers.back()->init(frames[0], rect, -1, -1);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t f = 1; f < frames.size(); ++f) {
+        results.emplace_back();
+        for (auto &tracker : trackers) {
+            tracker->track(frames[f]);
+            results.back().push_back(MultiKCF::Result{tracker->getBBox(), tracker->getFilterResponse()});
+        }
+    }
+    return since(start);
+}
+
+static double track_multi(std::vector<cv::Mat> &frames, const std::vector<cv::Rect> &rects, unsigned n_threads,
+                          unsigned fft_batch, Results &results)
+{
+    MultiKCF multi(n_threads);
+    multi.setFftBatch(fft_batch);
+    for (const cv::Rect &rect : rects)
+        multi.addTarget(frames[0], rect);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t f = 1; f < frames.size(); ++f) {
+        results.push_back(multi.track(frames[f]));
+    }
+    return since(start);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned n_targets = 8, fft_batch = 4, max_frames = 0;
+    // FFTW's batched plans may round differently than the single ones
+    const double batch_tolerance = 1e-4;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"help",    no_argument,       0, 'h' },
+            {"targets", required_argument, 0, 'n' },
+            {"batch",   required_argument, 0, 'b' },
+            {"frames",  required_argument, 0, 'f' },
+            {0,         0,                 0,  0 }
+        };
+
+        int c = getopt_long(argc, argv, "hn:b:f:", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            std::cerr << "Usage: \n"
+                      << argv[0] << " [options] <directory>\n"
+                      << argv[0] << " [options] <path/to/region.txt or groundtruth.txt> <path/to/images.txt>\n"
+                      << "Options:\n"
+                      << " --targets | -n <n>  number of targets (default 8)\n"
+                      << " --batch   | -b <n>  windows per batched FFT execution (default 4)\n"
+                      << " --frames  | -f <n>  track only the first n frames\n";
+            return 0;
+        case 'n':
+            n_targets = std::max(1, atoi(optarg));
+            break;
+        case 'b':
+            fft_batch = std::max(1, atoi(optarg));
+            break;
+        case 'f':
+            max_frames = std::max(0, atoi(optarg));
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    std::string region, images;
+    switch (argc - optind) {
+    case 1:
+        if (chdir(argv[optind]) == -1) {
+            perror(argv[optind]);
+            return 1;
+        }
+        region = access("groundtruth.txt", F_OK) == 0 ? "groundtruth.txt" : "region.txt";
+        images = "images.txt";
+        break;
+    case 2:
+        region = argv[optind];
+        images = argv[optind + 1];
+        break;
+    default:
+        std::cerr << "Wrong number of arguments, see " << argv[0] << " --help\n";
+        return 1;
+    }
+
+    // the frames are read first, so that only the tracking is measured
+    VOT vot_io(region, images, "/dev/null");
+    std::vector<cv::Mat> frames;
+    cv::Mat image;
+    while ((max_frames == 0 || frames.size() < max_frames) && vot_io.getNextImage(image) == 1)
+        frames.push_back(image.clone());
+    if (frames.size() < 2) {
+        std::cerr << "Error: the sequence has less than two frames\n";
+        return 1;
+    }
+    std::vector<cv::Rect> rects = targets(vot_io.getInitRectangle(), n_targets);
+
+    std::cout << "Tracking " << n_targets << " targets in " << frames.size() - 1 << " frames" << std::endl
+              << std::fixed;
+    Results expected;
+    double time_single = track_independent(frames, rects, expected) / (frames.size() - 1);
+    std::cout << "independent trackers: " << std::setprecision(2) << time_single * 1000 << " ms per frame"
+              << std::endl
+              << std::setw(8) << "threads" << std::setw(8) << "batch" << std::setw(12) << "ms/frame"
+              << std::setw(10) << "speedup" << std::setw(16) << "rel. difference" << std::endl;
+
+    unsigned n_cpus = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> thread_counts;
+    for (unsigned n = 1; n < n_cpus; n *= 2)
+        thread_counts.push_back(n);
+    thread_counts.push_back(n_cpus);
+
+    bool ok = true;
+    auto run = [&](unsigned n_threads, unsigned batch) {
+        Results results;
+        double time = track_multi(frames, rects, n_threads, batch, results) / (frames.size() - 1);
+        double diff = max_difference(expected, results);
+        bool match = batch ? diff <= batch_tolerance : diff == 0;
+        ok = ok && match;
+        std::cout << std::setw(8) << n_threads << std::setw(8) << (batch ? std::to_string(batch) : "-")
+                  << std::setw(12) << std::setprecision(2) << time * 1000 << std::setw(9) << time_single / time
+                  << "x" << std::setw(16) << std::scientific << std::setprecision(1) << diff << std::fixed
+                  << (match ? " ok" : " FAILED") << std::endl;
+    };
+    for (unsigned n_threads : thread_counts)
+        run(n_threads, 0);
+    for (unsigned n_threads : thread_counts)
+        run(n_threads, fft_batch);
+
+    std::cout << (ok ? "MultiKCF matches the independent trackers" : "MultiKCF differs from the independent trackers")
+              << std::endl;
+    return ok ? 0 : 1;
+}
@@ -6,6 +6,7 @@
 
 #include "kcf.h"
 #include "vot.hpp"
+#include "alloc_counter.hpp"
 
 double calcAccuracy(std::string line, cv::Rect bb_rect, cv::Rect &groundtruth_rect)
 {
@@ -35,8 +36,9 @@ double calcAccuracy(std::string line, cv::Rect bb_rect, cv::Rect &groundtruth_re
 int main(int argc, char *argv[])
 {
     //load region, images and prepare for output
-    std::string region, images, output;
-    int visualize_delay = -1, fit_size_x = -1, fit_size_y = -1;
+    std::string region, images, output, wisdom;
+    int visualize_delay = -1, fit_size_x = -1, fit_size_y = -1, prefetch_threads = 1;
+    bool check_allocs = false;
     KCF_Tracker tracker;
 
     while (1) {
@@ -47,15 +49,29 @@ int main(int argc, char *argv[])
             {"output",    required_argument, 0,  'o' },
             {"visualize", optional_argument, 0,  'v' },
             {"fit",       optional_argument, 0,  'f' },
+            {"check-allocs", no_argument,    0,  'a' },
+            {"reuse-features", optional_argument, 0, 'r' },
+            {"wisdom",    required_argument, 0,  'w' },
+            {"prefetch",  required_argument, 0,  'p' },
+            {"fft",       required_argument, 0,  'F' },
+            {"fft-size",  no_argument,       0,  's' },
+            {"pyramid",   optional_argument, 0,  'P' },
             {0,           0,                 0,  0 }
         };
 
-        int c = getopt_long(argc, argv, "dhv::f::o:",
+        int c = getopt_long(argc, argv, "adhv::f::o:p:r::sw:F:P::",
                         long_options, &option_index);
         if (c == -1)
             break;
 
         switch (c) {
+        case 'a':
+            if (!alloc_counter::supported()) {
+                std::cerr << "Error: --check-allocs is only supported by kcf_vot_noalloc (glibc only)\n";
+                exit(1);
+            }
+            check_allocs = true;
+            break;
         case 'd':
             tracker.m_debug = true;
             break;
@@ -64,16 +80,49 @@ int main(int argc, char *argv[])
                       << argv[0] << " [options]\n"
                       << argv[0] << " [options] <directory>\n"
                       << argv[0] << " [options] <path/to/region.txt or groundtruth.txt> <path/to/images.txt> [path/to/output.txt]\n"
+                      << "  Instead of images.txt, a frame cache, a video file or a capture device number can be given.\n"
                       << "Options:\n"
                       << " --visualize | -v[delay_ms]\n"
                       << " --output    | -o <output.txt>\n"
                       << " --debug     | -d\n"
-                      << " --fit       | -f[WxH]\n";
+                      << " --fit       | -f[WxH]\n"
+                      << " --check-allocs | -a  fail if tracking a frame allocates heap memory\n"
+                      << " --reuse-features | -r[max_shift]  train on the shifted detection features\n"
+                      << " --wisdom    | -w <file>  load and save FFT planner wisdom\n"
+                      << " --prefetch  | -p <threads>  decode the images in <threads> threads (default 1), 0 = off\n"
+                      << " --fft       | -F <name>  FFT implementation:";
+            for (const std::string &name : Fft::implementations())
+                std::cerr << " " << name;
+            std::cerr << " or auto for the fastest\n"
+                      << " --fft-size  | -s  enlarge the window to a size with fast FFTs\n"
+                      << " --pyramid   | -P[lambda]  resample the scales from one HOG extraction\n";
             exit(0);
             break;
         case 'o':
             output = optarg;
             break;
+        case 'w':
+            wisdom = optarg;
+            break;
+        case 'p':
+            prefetch_threads = atoi(optarg);
+            break;
+        case 'F':
+            tracker.m_fft_implementation = optarg;
+            break;
+        case 's':
+            tracker.m_use_fft_friendly_size = true;
+            break;
+        case 'P':
+            tracker.m_use_feature_pyramid = true;
+            if (optarg)
+                tracker.m_pyramid_lambda = atof(optarg);
+            break;
+        case 'r':
+            tracker.m_reuse_detection_features = true;
+            if (optarg)
+                tracker.m_max_reuse_shift = atof(optarg);
+            break;
         case 'v':
             visualize_delay = optarg ? atol(optarg) : 1;
             break;
@@ -120,6 +169,9 @@ int main(int argc, char *argv[])
         return 1;
     }
     VOT vot_io(region, images, output);
+    // the decoder threads would allocate while a frame is being tracked
+    if (!check_allocs)
+        vot_io.startPrefetch(std::max(prefetch_threads, 0));
 
     // if groundtruth.txt is used use intersection over union (IOU) to calculate tracker accuracy
     std::ifstream groundtruth_stream;
@@ -136,21 +188,34 @@ int main(int argc, char *argv[])
     vot_io.outputBoundingBox(init_rect);
     vot_io.getNextImage(image);
 
+    if (!wisdom.empty())
+        Fft::load_wisdom(wisdom);
     tracker.init(image, init_rect, fit_size_x, fit_size_y);
+    if (!wisdom.empty() && !Fft::save_wisdom(wisdom))
+        std::cerr << "Warning: FFT wisdom could not be saved to " << wisdom << std::endl;
 
     BBox_c bb;
     cv::Rect bb_rect;
-    double avg_time = 0., sum_accuracy = 0.;
+    double avg_time = 0., sum_accuracy = 0., sum_decode = 0., sum_wait = 0.;
     int frames = 0;
 
     std::cout << std::fixed << std::setprecision(2);
 
     while (vot_io.getNextImage(image) == 1){
+        sum_decode += vot_io.lastDecodeTime();
+        sum_wait += vot_io.lastWaitTime();
         double time_profile_counter = cv::getCPUTickCount();
+        if (check_allocs)
+            alloc_counter::start();
         tracker.track(image);
+        unsigned long allocs = check_allocs ? alloc_counter::stop() : 0;
         time_profile_counter = cv::getCPUTickCount() - time_profile_counter;
+        if (allocs) {
+            std::cerr << "Error: " << allocs << " heap allocations while tracking frame " << frames + 1 << std::endl;
+            return EXIT_FAILURE;
+        }
          std::cout << "  -> speed : " <<  time_profile_counter/((double)cvGetTickFrequency()*1000) << "ms per frame, "
-                      "response : " << tracker.getFilterResponse();
+                      "decode : " << vot_io.lastDecodeTime() << "ms, response : " << tracker.getFilterResponse();
         avg_time += time_profile_counter/((double)cvGetTickFrequency()*1000);
         frames++;
 
@@ -207,6 +272,8 @@ int main(int argc, char *argv[])
         groundtruth_stream.close();
     }
     std::cout << std::endl;
+    std::cout << "Image decoding: " << sum_decode / frames << "ms per frame, tracking waited "
+              << sum_wait / frames << "ms per frame" << std::endl;
 
     return EXIT_SUCCESS;
 }
@@ -13,6 +13,14 @@ public:
     static std::vector<cv::Mat> extract(const cv::Mat & patch_rgb)
     {
         std::vector<cv::Mat> cn_feat(p_cn_channels);
+        extract(patch_rgb, cn_feat.data());
+        return cn_feat;
+    }
+
+    // Write the features to num_channels() matrices starting at cn_feat,
+    // matrices of the right size are reused.
+    static void extract(const cv::Mat & patch_rgb, cv::Mat * cn_feat)
+    {
         for (int i = 0; i < p_cn_channels; ++i) {
             cn_feat[i].create(patch_rgb.size(), CV_32FC1);
         }
@@ -28,9 +36,28 @@ public:
                     ch_ptr[i][x] = p_id2feat[rgb2id(bgr_val[2], bgr_val[1], bgr_val[0])][i];
             }
         }
-        return cn_feat;
     }
 
+    // Write the features row-major to dst, channel i starting at
+    // dst + i*chn_stride, each multiplied by window (CV_32F, size of
+    // patch_rgb) if not empty.
+    static void extract(const cv::Mat & patch_rgb, float * dst, int chn_stride, const cv::Mat & window)
+    {
+        for (int y = 0; y < patch_rgb.rows; ++y) {
+            const float * w_ptr = window.empty() ? nullptr : window.ptr<float>(y);
+            float * row_ptr = dst + y * patch_rgb.cols;
+            for (int x = 0; x < patch_rgb.cols; ++x) {
+                //images in opencv stored in BGR order
+                cv::Vec3b bgr_val = patch_rgb.at<cv::Vec3b>(y,x);
+                const float * feat = p_id2feat[rgb2id(bgr_val[2], bgr_val[1], bgr_val[0])];
+                float w = w_ptr ? w_ptr[x] : 1.f;
+                for (int i = 0; i < p_cn_channels; ++i)
+                    row_ptr[i * chn_stride + x] = feat[i] * w;
+            }
+        }
+    }
+    static int num_channels() { return p_cn_channels; }
+
 private:
     inline static int rgb2id(int r, int g, int b)
     {   return (r >> 3) + 32*(g >> 3) + 32*32*(b >> 3);     }
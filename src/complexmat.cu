@@ -262,6 +262,31 @@ ComplexMat ComplexMat::mul2(const ComplexMat &rhs) const
     return result;
 }
 
+__global__ void shift_kernel(float *data, float *result, int rows, int cols, float dx, float dy, int width)
+{
+    int blockId = blockIdx.x + blockIdx.y * gridDim.x;
+    int i = threadIdx.y * blockDim.x + threadIdx.x;
+    int threadId = 2 * (blockId * (blockDim.x * blockDim.y) + i);
+    int y = i / cols, x = i % cols;
+    int ky = y <= rows / 2 ? y : y - rows, kx = x <= width / 2 ? x : x - width;
+    float s, c;
+
+    sincosf(6.28318530718f * (kx * dx / width + ky * dy / rows), &s, &c);
+    result[threadId] = data[threadId] * c - data[threadId + 1] * s;
+    result[threadId + 1] = data[threadId] * s + data[threadId + 1] * c;
+}
+
+void ComplexMat::set_shifted(const ComplexMat &src, uint first_channel, uint n, float dx, float dy, uint width)
+{
+    assert(rows == src.rows && cols == src.cols && n_channels == n && first_channel + n <= src.n_channels);
+
+    dim3 threadsPerBlock(rows, cols);
+    dim3 numBlocks(n, 1);
+    shift_kernel<<<numBlocks, threadsPerBlock, 0, this->stream>>>(src.p_data + 2 * first_channel * rows * cols,
+                                                                  this->p_data, rows, cols, dx, dy, width);
+    CudaCheckError();
+}
+
 void ComplexMat::operator=(ComplexMat &rhs)
 {
     cols = rhs.cols;
@@ -104,6 +104,10 @@ class ComplexMat {
 
     // multiplying element-wise multichannel by one channel mats (rhs mat is with multiple channel)
     ComplexMat mul2(const ComplexMat &rhs) const;
+
+    // copies n channels of src starting with first_channel, shifted by (dx, dy) in the spatial domain
+    // (see complexmat.hpp), this mat must already have the right size
+    void set_shifted(const ComplexMat &src, uint first_channel, uint n, float dx, float dy, uint width);
     // text output
     friend std::ostream &operator<<(std::ostream &os, const ComplexMat &mat)
     {
@@ -4,10 +4,291 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <algorithm>
-#include <functional>
 #include "dynmem.hpp"
+#include "simd_kernels.h"
 
-template <typename T> class ComplexMat_ {
+template <typename T> class ComplexMat_;
+
+// Operands of an expression are held by reference when they are
+// matrices and by value when they are (lightweight) expression nodes,
+// so that temporaries created inside one full expression stay valid.
+template <typename E> struct ComplexMatExprRef {
+    typedef const E type;
+};
+template <typename T> struct ComplexMatExprRef<ComplexMat_<T>> {
+    typedef const ComplexMat_<T> &type;
+};
+
+template <typename L, typename R, typename Op> class ComplexMatBinary;
+template <typename L, typename R, typename Op> class ComplexMatBroadcast;
+template <typename L, typename R, typename Op> class ComplexMatBroadcastScales;
+template <typename E, typename Op> class ComplexMatScalar;
+template <typename E, typename Op> class ComplexMatUnary;
+template <typename E> class ComplexMatChannelSum;
+
+struct ComplexMulOp {
+    template <typename T> static std::complex<T> apply(const std::complex<T> &a, const std::complex<T> &b)
+    {
+        return std::complex<T>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+    }
+};
+struct ComplexDivOp {
+    template <typename T> static std::complex<T> apply(const std::complex<T> &a, const std::complex<T> &b)
+    {
+        T inv = T(1) / (b.real() * b.real() + b.imag() * b.imag());
+        return std::complex<T>((a.real() * b.real() + a.imag() * b.imag()) * inv,
+                               (a.imag() * b.real() - a.real() * b.imag()) * inv);
+    }
+};
+struct ComplexAddOp {
+    template <typename T> static std::complex<T> apply(const std::complex<T> &a, const std::complex<T> &b)
+    {
+        return a + b;
+    }
+};
+struct ComplexScaleOp {
+    template <typename T> static std::complex<T> apply(const std::complex<T> &a, const T &s)
+    {
+        return std::complex<T>(a.real() * s, a.imag() * s);
+    }
+};
+struct ComplexAddRealOp {
+    template <typename T> static std::complex<T> apply(const std::complex<T> &a, const T &s)
+    {
+        return std::complex<T>(a.real() + s, a.imag());
+    }
+};
+struct ComplexConjOp {
+    template <typename T> static std::complex<T> apply(const std::complex<T> &a)
+    {
+        return std::complex<T>(a.real(), -a.imag());
+    }
+};
+struct ComplexSqrMagOp {
+    template <typename T> static std::complex<T> apply(const std::complex<T> &a)
+    {
+        return std::complex<T>(a.real() * a.real() + a.imag() * a.imag(), 0);
+    }
+};
+
+// Base of all ComplexMat_ expressions (CRTP). Arithmetic does not compute
+// anything, it only builds an expression tree. The tree is evaluated in a
+// single loop, element by element, when assigned to a ComplexMat_.
+//
+// Every expression E provides the same public shape fields as ComplexMat_
+// (rows, cols, n_channels, n_scales), an element accessor
+// operator()(channel, index_in_channel) and aliases(ptr), which tells
+// whether the expression reads the given matrix data.
+template <typename E, typename T> class ComplexMatExpr {
+  public:
+    typedef T value_type;
+
+    const E &self() const { return static_cast<const E &>(*this); }
+
+    // element-wise per channel multiplication, division and addition
+    template <typename R>
+    ComplexMatBinary<E, R, ComplexMulOp> operator*(const ComplexMatExpr<R, T> &rhs) const
+    {
+        return ComplexMatBinary<E, R, ComplexMulOp>(self(), rhs.self());
+    }
+    template <typename R>
+    ComplexMatBinary<E, R, ComplexDivOp> operator/(const ComplexMatExpr<R, T> &rhs) const
+    {
+        return ComplexMatBinary<E, R, ComplexDivOp>(self(), rhs.self());
+    }
+    template <typename R>
+    ComplexMatBinary<E, R, ComplexAddOp> operator+(const ComplexMatExpr<R, T> &rhs) const
+    {
+        return ComplexMatBinary<E, R, ComplexAddOp>(self(), rhs.self());
+    }
+
+    // multiplying or adding constant
+    ComplexMatScalar<E, ComplexScaleOp> operator*(const T &rhs) const
+    {
+        return ComplexMatScalar<E, ComplexScaleOp>(self(), rhs);
+    }
+    ComplexMatScalar<E, ComplexAddRealOp> operator+(const T &rhs) const
+    {
+        return ComplexMatScalar<E, ComplexAddRealOp>(self(), rhs);
+    }
+
+    // multiplying element-wise multichannel by one channel mats (rhs mat is with one channel)
+    template <typename R> ComplexMatBroadcast<E, R, ComplexMulOp> mul(const ComplexMatExpr<R, T> &rhs) const
+    {
+        return ComplexMatBroadcast<E, R, ComplexMulOp>(self(), rhs.self());
+    }
+
+    // multiplying element-wise multichannel by one channel mats (rhs mat is with multiple channel)
+    template <typename R>
+    ComplexMatBroadcastScales<E, R, ComplexMulOp> mul2(const ComplexMatExpr<R, T> &rhs) const
+    {
+        return ComplexMatBroadcastScales<E, R, ComplexMulOp>(self(), rhs.self());
+    }
+
+    ComplexMatUnary<E, ComplexSqrMagOp> sqr_mag() const { return ComplexMatUnary<E, ComplexSqrMagOp>(self()); }
+    ComplexMatUnary<E, ComplexConjOp> conj() const { return ComplexMatUnary<E, ComplexConjOp>(self()); }
+
+    ComplexMatChannelSum<E> sum_over_channels() const { return ComplexMatChannelSum<E>(self()); }
+};
+
+template <typename L, typename R, typename Op>
+class ComplexMatBinary : public ComplexMatExpr<ComplexMatBinary<L, R, Op>, typename L::value_type> {
+  public:
+    typedef typename L::value_type T;
+    uint cols, rows, n_channels, n_scales;
+
+    ComplexMatBinary(const L &l, const R &r)
+        : cols(l.cols), rows(l.rows), n_channels(l.n_channels), n_scales(l.n_scales), lhs(l), rhs(r)
+    {
+        assert(r.n_channels == l.n_channels && r.cols == l.cols && r.rows == l.rows);
+    }
+    std::complex<T> operator()(uint ch, uint i) const { return Op::apply(lhs(ch, i), rhs(ch, i)); }
+    bool aliases(const std::complex<T> *p) const { return lhs.aliases(p) || rhs.aliases(p); }
+
+    typename ComplexMatExprRef<L>::type lhs;
+    typename ComplexMatExprRef<R>::type rhs;
+};
+
+template <typename L, typename R, typename Op>
+class ComplexMatBroadcast : public ComplexMatExpr<ComplexMatBroadcast<L, R, Op>, typename L::value_type> {
+  public:
+    typedef typename L::value_type T;
+    uint cols, rows, n_channels, n_scales;
+
+    ComplexMatBroadcast(const L &l, const R &r)
+        : cols(l.cols), rows(l.rows), n_channels(l.n_channels), n_scales(l.n_scales), lhs(l), rhs(r)
+    {
+        assert(r.n_channels == 1 && r.cols == l.cols && r.rows == l.rows);
+    }
+    std::complex<T> operator()(uint ch, uint i) const { return Op::apply(lhs(ch, i), rhs(0, i)); }
+    bool aliases(const std::complex<T> *p) const { return lhs.aliases(p) || rhs.aliases(p); }
+
+    typename ComplexMatExprRef<L>::type lhs;
+    typename ComplexMatExprRef<R>::type rhs;
+};
+
+template <typename L, typename R, typename Op>
+class ComplexMatBroadcastScales
+    : public ComplexMatExpr<ComplexMatBroadcastScales<L, R, Op>, typename L::value_type> {
+  public:
+    typedef typename L::value_type T;
+    uint cols, rows, n_channels, n_scales;
+
+    ComplexMatBroadcastScales(const L &l, const R &r)
+        : cols(l.cols), rows(l.rows), n_channels(l.n_channels), n_scales(l.n_scales), lhs(l), rhs(r)
+    {
+        assert(r.n_channels == l.n_channels / l.n_scales && r.cols == l.cols && r.rows == l.rows);
+    }
+    std::complex<T> operator()(uint ch, uint i) const { return Op::apply(lhs(ch, i), rhs(ch % rhs.n_channels, i)); }
+    bool aliases(const std::complex<T> *p) const { return lhs.aliases(p) || rhs.aliases(p); }
+
+    typename ComplexMatExprRef<L>::type lhs;
+    typename ComplexMatExprRef<R>::type rhs;
+};
+
+template <typename E, typename Op>
+class ComplexMatScalar : public ComplexMatExpr<ComplexMatScalar<E, Op>, typename E::value_type> {
+  public:
+    typedef typename E::value_type T;
+    uint cols, rows, n_channels, n_scales;
+
+    ComplexMatScalar(const E &e, const T &s)
+        : cols(e.cols), rows(e.rows), n_channels(e.n_channels), n_scales(e.n_scales), expr(e), scalar(s)
+    {}
+    std::complex<T> operator()(uint ch, uint i) const { return Op::apply(expr(ch, i), scalar); }
+    bool aliases(const std::complex<T> *p) const { return expr.aliases(p); }
+
+    typename ComplexMatExprRef<E>::type expr;
+    const T scalar;
+};
+
+template <typename E, typename Op>
+class ComplexMatUnary : public ComplexMatExpr<ComplexMatUnary<E, Op>, typename E::value_type> {
+  public:
+    typedef typename E::value_type T;
+    uint cols, rows, n_channels, n_scales;
+
+    ComplexMatUnary(const E &e) : cols(e.cols), rows(e.rows), n_channels(e.n_channels), n_scales(e.n_scales), expr(e) {}
+    std::complex<T> operator()(uint ch, uint i) const { return Op::apply(expr(ch, i)); }
+    bool aliases(const std::complex<T> *p) const { return expr.aliases(p); }
+
+    typename ComplexMatExprRef<E>::type expr;
+};
+
+// Sums the channels of every scale, the result has one channel per scale
+template <typename E>
+class ComplexMatChannelSum : public ComplexMatExpr<ComplexMatChannelSum<E>, typename E::value_type> {
+  public:
+    typedef typename E::value_type T;
+    uint cols, rows, n_channels, n_scales = 1;
+
+    ComplexMatChannelSum(const E &e)
+        : cols(e.cols), rows(e.rows), n_channels(e.n_scales), expr(e), n_channels_per_scale(e.n_channels / e.n_scales)
+    {
+        assert(e.n_channels >= 1);
+    }
+    std::complex<T> operator()(uint scale, uint i) const
+    {
+        std::complex<T> sum = expr(scale * n_channels_per_scale, i);
+        for (uint ch = 1; ch < n_channels_per_scale; ++ch)
+            sum += expr(scale * n_channels_per_scale + ch, i);
+        return sum;
+    }
+    bool aliases(const std::complex<T> *p) const { return expr.aliases(p); }
+
+    typename ComplexMatExprRef<E>::type expr;
+
+  private:
+    const uint n_channels_per_scale;
+};
+
+// Hand-vectorised evaluation of the most frequent expression shapes (see
+// simd_kernels.h). The overloads return false when the expression has to
+// be evaluated by the generic loop.
+template <typename T, typename E> bool assign_simd(ComplexMat_<T> &, const E &)
+{
+    return false;
+}
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatBinary<ComplexMat_<float>, ComplexMat_<float>, ComplexMulOp> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatBinary<ComplexMat_<float>, ComplexMatUnary<ComplexMat_<float>, ComplexConjOp>,
+                                        ComplexMulOp> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatBinary<ComplexMat_<float>, ComplexMat_<float>, ComplexDivOp> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatBinary<ComplexMatScalar<ComplexMat_<float>, ComplexScaleOp>,
+                                        ComplexMatScalar<ComplexMat_<float>, ComplexScaleOp>, ComplexAddOp> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatBroadcast<ComplexMat_<float>, ComplexMat_<float>, ComplexMulOp> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatBroadcastScales<ComplexMat_<float>,
+                                                 ComplexMatUnary<ComplexMat_<float>, ComplexConjOp>, ComplexMulOp> &e);
+bool assign_simd(ComplexMat_<float> &dst, const ComplexMatChannelSum<ComplexMat_<float>> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatChannelSum<ComplexMatBinary<ComplexMat_<float>, ComplexMat_<float>, ComplexMulOp>> &e);
+bool assign_simd(
+    ComplexMat_<float> &dst,
+    const ComplexMatChannelSum<ComplexMatBroadcastScales<ComplexMat_<float>, ComplexMat_<float>, ComplexMulOp>> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatChannelSum<ComplexMatBroadcastScales<
+                     ComplexMat_<float>, ComplexMatUnary<ComplexMat_<float>, ComplexConjOp>, ComplexMulOp>> &e);
+bool assign_simd(ComplexMat_<float> &dst,
+                 const ComplexMatChannelSum<ComplexMatUnary<ComplexMat_<float>, ComplexSqrMagOp>> &e);
+
+template <typename T> T sqr_norm_kernel(const std::complex<T> *data, size_t n)
+{
+    T sum_sqr_norm = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum_sqr_norm += data[i].real() * data[i].real() + data[i].imag() * data[i].imag();
+    return sum_sqr_norm;
+}
+inline float sqr_norm_kernel(const std::complex<float> *data, size_t n)
+{
+    return simd_kernels().sqr_norm(reinterpret_cast<const float *>(data), n);
+}
+
+template <typename T> class ComplexMat_ : public ComplexMatExpr<ComplexMat_<T>, T> {
   public:
     uint cols;
     uint rows;
@@ -17,19 +298,91 @@ template <typename T> class ComplexMat_ {
     ComplexMat_() : cols(0), rows(0), n_channels(0) {}
     ComplexMat_(uint _rows, uint _cols, uint _n_channels) : cols(_cols), rows(_rows), n_channels(_n_channels)
     {
-        p_data.resize(n_channels * cols * rows);
+        reserve(num_elem());
+        std::fill_n(p_data, num_elem(), std::complex<T>());
     }
 
     ComplexMat_(uint _rows, uint _cols, uint _n_channels, uint _n_scales)
         : cols(_cols), rows(_rows), n_channels(_n_channels), n_scales(_n_scales)
     {
-        p_data.resize(n_channels * cols * rows);
+        reserve(num_elem());
+        std::fill_n(p_data, num_elem(), std::complex<T>());
     }
 
     // assuming that mat has 2 channels (real, img)
     ComplexMat_(const cv::Mat &mat) : cols(uint(mat.cols)), rows(uint(mat.rows)), n_channels(1)
     {
-        p_data = convert(mat);
+        reserve(num_elem());
+        convert(mat);
+    }
+
+    ComplexMat_(const ComplexMat_ &other) : cols(0), rows(0), n_channels(0)
+    {
+        *this = other;
+    }
+    ComplexMat_(ComplexMat_ &&other)
+        : cols(other.cols), rows(other.rows), n_channels(other.n_channels), n_scales(other.n_scales),
+          p_data(other.p_data), p_capacity(other.p_capacity), foreign_data(other.foreign_data)
+    {
+        other.p_data = nullptr;
+        other.p_capacity = 0;
+        other.foreign_data = false;
+    }
+    ~ComplexMat_()
+    {
+        release();
+    }
+
+    ComplexMat_ &operator=(const ComplexMat_ &other)
+    {
+        if (this != &other) {
+            create(other.rows, other.cols, other.n_channels, other.n_scales);
+            std::copy(other.p_data, other.p_data + num_elem(), p_data);
+        }
+        return *this;
+    }
+    ComplexMat_ &operator=(ComplexMat_ &&other)
+    {
+        if (this != &other) {
+            release();
+            cols = other.cols;
+            rows = other.rows;
+            n_channels = other.n_channels;
+            n_scales = other.n_scales;
+            p_data = other.p_data;
+            p_capacity = other.p_capacity;
+            foreign_data = other.foreign_data;
+            other.p_data = nullptr;
+            other.p_capacity = 0;
+            other.foreign_data = false;
+        }
+        return *this;
+    }
+
+    // Use the memory of an arena (see dynmem.hpp) for a matrix of the given
+    // size. Later create() calls keep the memory as long as the size fits.
+    void create(uint _rows, uint _cols, uint _n_channels, uint _n_scales, Arena &arena)
+    {
+        release();
+        p_capacity = size_t(_n_channels) * _cols * _rows;
+        p_data = static_cast<std::complex<T> *>(arena.alloc(p_capacity * sizeof(std::complex<T>)));
+        foreign_data = true;
+        create(_rows, _cols, _n_channels, _n_scales);
+    }
+    static size_t arena_size(uint _rows, uint _cols, uint _n_channels)
+    {
+        return dynmem_align(size_t(_n_channels) * _cols * _rows * sizeof(std::complex<T>));
+    }
+
+    // evaluate an expression (see ComplexMatExpr)
+    template <typename E> ComplexMat_(const ComplexMatExpr<E, T> &expr) : cols(0), rows(0), n_channels(0)
+    {
+        assign(expr.self());
+    }
+    template <typename E> ComplexMat_ &operator=(const ComplexMatExpr<E, T> &expr)
+    {
+        assign(expr.self());
+        return *this;
     }
 
     void create(uint _rows, uint _cols, uint _n_channels)
@@ -37,7 +390,7 @@ template <typename T> class ComplexMat_ {
         rows = _rows;
         cols = _cols;
         n_channels = _n_channels;
-        p_data.resize(n_channels * cols * rows);
+        reserve(num_elem());
     }
 
     void create(uint _rows, uint _cols, uint _n_channels, uint _n_scales)
@@ -46,7 +399,7 @@ template <typename T> class ComplexMat_ {
         cols = _cols;
         n_channels = _n_channels;
         n_scales = _n_scales;
-        p_data.resize(n_channels * cols * rows);
+        reserve(num_elem());
     }
     // cv::Mat API compatibility
     cv::Size size() { return cv::Size(cols, rows); }
@@ -63,14 +416,32 @@ template <typename T> class ComplexMat_ {
         }
     }
 
+    // Copies n channels of src, starting with first_channel, multiplied by
+    // the phase ramp of the cyclic shift out(x, y) = in(x + dx, y + dy) of
+    // the spatial signal. width is the width of that signal, cols is
+    // width / 2 + 1 for half spectra.
+    void set_shifted(const ComplexMat_ &src, uint first_channel, uint n, T dx, T dy, uint width)
+    {
+        assert(first_channel + n <= src.n_channels && src.p_data != p_data);
+        create(src.rows, src.cols, n, 1);
+        const size_t n_elem = size_t(rows) * cols;
+        const std::complex<T> *in = src.p_data + first_channel * n_elem;
+        for (uint y = 0; y < rows; ++y) {
+            int ky = y <= rows / 2 ? int(y) : int(y) - int(rows);
+            for (uint x = 0; x < cols; ++x) {
+                int kx = x <= width / 2 ? int(x) : int(x) - int(width);
+                std::complex<T> phase = std::polar(T(1), T(2 * CV_PI) * (kx * dx / width + ky * dy / rows));
+                size_t i = size_t(y) * cols + x;
+                for (uint ch = 0; ch < n; ++ch)
+                    p_data[ch * n_elem + i] = in[ch * n_elem + i] * phase;
+            }
+        }
+    }
+
     T sqr_norm() const
     {
         int n_channels_per_scale = n_channels / n_scales;
-        T sum_sqr_norm = 0;
-        for (int i = 0; i < n_channels_per_scale; ++i) {
-            for (auto lhs = p_data.begin() + i * rows * cols; lhs != p_data.begin() + (i + 1) * rows * cols; ++lhs)
-                sum_sqr_norm += lhs->real() * lhs->real() + lhs->imag() * lhs->imag();
-        }
+        T sum_sqr_norm = sqr_norm_kernel(p_data, n_channels_per_scale * rows * cols);
         sum_sqr_norm = sum_sqr_norm / static_cast<T>(cols * rows);
         return sum_sqr_norm;
     }
@@ -80,51 +451,16 @@ template <typename T> class ComplexMat_ {
         int n_channels_per_scale = n_channels / n_scales;
         int scale_offset = n_channels_per_scale * rows * cols;
         for (uint scale = 0; scale < n_scales; ++scale) {
-            T sum_sqr_norm = 0;
-            for (int i = 0; i < n_channels_per_scale; ++i)
-                for (auto lhs = p_data.begin() + i * rows * cols + scale * scale_offset;
-                     lhs != p_data.begin() + (i + 1) * rows * cols + scale * scale_offset; ++lhs)
-                    sum_sqr_norm += lhs->real() * lhs->real() + lhs->imag() * lhs->imag();
+            T sum_sqr_norm = sqr_norm_kernel(p_data + scale * scale_offset, scale_offset);
             result.hostMem()[scale] = sum_sqr_norm / static_cast<T>(cols * rows);
         }
         return;
     }
 
-    ComplexMat_<T> sqr_mag() const
-    {
-        return mat_const_operator([](std::complex<T> &c) { c = c.real() * c.real() + c.imag() * c.imag(); });
-    }
-
-    ComplexMat_<T> conj() const
-    {
-        return mat_const_operator([](std::complex<T> &c) { c = std::complex<T>(c.real(), -c.imag()); });
-    }
-
-    ComplexMat_<T> sum_over_channels() const
-    {
-        assert(p_data.size() > 1);
-
-        int n_channels_per_scale = n_channels / n_scales;
-        int scale_offset = n_channels_per_scale * rows * cols;
-
-        ComplexMat_<T> result(this->rows, this->cols, n_scales);
-        for (uint scale = 0; scale < n_scales; ++scale) {
-            std::copy(p_data.begin() + scale * scale_offset, p_data.begin() + rows * cols + scale * scale_offset,
-                      result.p_data.begin() + scale * rows * cols);
-            for (int i = 1; i < n_channels_per_scale; ++i) {
-                std::transform(result.p_data.begin() + scale * rows * cols,
-                               result.p_data.begin() + (scale + 1) * rows * cols,
-                               p_data.begin() + i * rows * cols + scale * scale_offset,
-                               result.p_data.begin() + scale * rows * cols, std::plus<std::complex<T>>());
-            }
-        }
-        return result;
-    }
-
     // return 2 channels (real, imag) for first complex channel
     cv::Mat to_cv_mat() const
     {
-        assert(p_data.size() >= 1);
+        assert(num_elem() >= 1);
         return channel_to_cv_mat(0);
     }
     // return a vector of 2 channels (real, imag) per one complex channel
@@ -138,44 +474,23 @@ template <typename T> class ComplexMat_ {
 
         return result;
     }
-
-    std::complex<T> *get_p_data() const { return p_data.data(); }
-
-    // element-wise per channel multiplication, division and addition
-    ComplexMat_<T> operator*(const ComplexMat_<T> &rhs) const
+    // write channel as 2 channel (real, imag) mat, result is reused if it has the right size
+    void to_cv_mat(uint channel, cv::Mat &result) const
     {
-        return mat_mat_operator([](std::complex<T> &c_lhs, const std::complex<T> &c_rhs) { c_lhs *= c_rhs; }, rhs);
-    }
-    ComplexMat_<T> operator/(const ComplexMat_<T> &rhs) const
-    {
-        return mat_mat_operator([](std::complex<T> &c_lhs, const std::complex<T> &c_rhs) { c_lhs /= c_rhs; }, rhs);
-    }
-    ComplexMat_<T> operator+(const ComplexMat_<T> &rhs) const
-    {
-        return mat_mat_operator([](std::complex<T> &c_lhs, const std::complex<T> &c_rhs) { c_lhs += c_rhs; }, rhs);
-    }
-
-    // multiplying or adding constant
-    ComplexMat_<T> operator*(const T &rhs) const
-    {
-        return mat_const_operator([&rhs](std::complex<T> &c) { c *= rhs; });
-    }
-    ComplexMat_<T> operator+(const T &rhs) const
-    {
-        return mat_const_operator([&rhs](std::complex<T> &c) { c += rhs; });
+        result.create(rows, cols, CV_32FC2);
+        for (uint y = 0; y < rows; ++y) {
+            std::complex<T> *row_ptr = result.ptr<std::complex<T>>(y);
+            for (uint x = 0; x < cols; ++x) {
+                row_ptr[x] = p_data[channel * rows * cols + y * cols + x];
+            }
+        }
     }
 
-    // multiplying element-wise multichannel by one channel mats (rhs mat is with one channel)
-    ComplexMat_<T> mul(const ComplexMat_<T> &rhs) const
-    {
-        return matn_mat1_operator([](std::complex<T> &c_lhs, const std::complex<T> &c_rhs) { c_lhs *= c_rhs; }, rhs);
-    }
+    std::complex<T> *get_p_data() const { return p_data; }
 
-    // multiplying element-wise multichannel by one channel mats (rhs mat is with multiple channel)
-    ComplexMat_<T> mul2(const ComplexMat_<T> &rhs) const
-    {
-        return matn_mat2_operator([](std::complex<T> &c_lhs, const std::complex<T> &c_rhs) { c_lhs *= c_rhs; }, rhs);
-    }
+    // expression leaf
+    std::complex<T> operator()(uint ch, uint i) const { return p_data[ch * rows * cols + i]; }
+    bool aliases(const std::complex<T> *p) const { return p == p_data; }
 
     // text output
     friend std::ostream &operator<<(std::ostream &os, const ComplexMat_<T> &mat)
@@ -193,94 +508,205 @@ template <typename T> class ComplexMat_ {
     }
 
   private:
-    mutable std::vector<std::complex<T>> p_data;
+    std::complex<T> *p_data = nullptr;
+    size_t p_capacity = 0;
+    bool foreign_data = false;
+
+    size_t num_elem() const { return size_t(n_channels) * cols * rows; }
 
-    // convert 2 channel mat (real, imag) to vector row-by-row
-    std::vector<std::complex<T>> convert(const cv::Mat &mat)
+    // make room for n elements, the content is not preserved
+    void reserve(size_t n)
     {
-        std::vector<std::complex<T>> result;
-        result.reserve(mat.cols * mat.rows);
-        for (int y = 0; y < mat.rows; ++y) {
-            const T *row_ptr = mat.ptr<T>(y);
-            for (int x = 0; x < 2 * mat.cols; x += 2) {
-                result.push_back(std::complex<T>(row_ptr[x], row_ptr[x + 1]));
-            }
-        }
-        return result;
+        if (n <= p_capacity)
+            return;
+        release();
+        p_data = static_cast<std::complex<T> *>(dynmem_malloc(n * sizeof(std::complex<T>)));
+        p_capacity = n;
     }
 
-    ComplexMat_<T> mat_mat_operator(void (*op)(std::complex<T> &c_lhs, const std::complex<T> &c_rhs),
-                                    const ComplexMat_<T> &mat_rhs) const
+    void release()
     {
-        assert(mat_rhs.n_channels == n_channels && mat_rhs.cols == cols && mat_rhs.rows == rows);
-
-        ComplexMat_<T> result = *this;
-        for (uint i = 0; i < n_channels; ++i) {
-            auto lhs = result.p_data.begin() + i * rows * cols;
-            auto rhs = mat_rhs.p_data.begin() + i * rows * cols;
-            for (; lhs != result.p_data.begin() + (i + 1) * rows * cols; ++lhs, ++rhs)
-                op(*lhs, *rhs);
-        }
-
-        return result;
+        if (!foreign_data)
+            dynmem_free(p_data);
+        p_data = nullptr;
+        p_capacity = 0;
+        foreign_data = false;
     }
-    ComplexMat_<T> matn_mat1_operator(void (*op)(std::complex<T> &c_lhs, const std::complex<T> &c_rhs),
-                                      const ComplexMat_<T> &mat_rhs) const
-    {
-        assert(mat_rhs.n_channels == 1 && mat_rhs.cols == cols && mat_rhs.rows == rows);
 
-        ComplexMat_<T> result = *this;
-        for (uint i = 0; i < n_channels; ++i) {
-            auto lhs = result.p_data.begin() + i * rows * cols;
-            auto rhs = mat_rhs.p_data.begin();
-            for (; lhs != result.p_data.begin() + (i + 1) * rows * cols; ++lhs, ++rhs)
-                op(*lhs, *rhs);
-        }
-
-        return result;
-    }
-    ComplexMat_<T> matn_mat2_operator(void (*op)(std::complex<T> &c_lhs, const std::complex<T> &c_rhs),
-                                      const ComplexMat_<T> &mat_rhs) const
+    // convert 2 channel mat (real, imag) to data row-by-row
+    void convert(const cv::Mat &mat)
     {
-        assert(mat_rhs.n_channels == n_channels / n_scales && mat_rhs.cols == cols && mat_rhs.rows == rows);
-
-        int n_channels_per_scale = n_channels / n_scales;
-        int scale_offset = n_channels_per_scale * rows * cols;
-        ComplexMat_<T> result = *this;
-        for (uint i = 0; i < n_scales; ++i) {
-            for (int j = 0; j < n_channels_per_scale; ++j) {
-                auto lhs = result.p_data.begin() + (j * rows * cols) + (i * scale_offset);
-                auto rhs = mat_rhs.p_data.begin() + (j * rows * cols);
-                for (; lhs != result.p_data.begin() + ((j + 1) * rows * cols) + (i * scale_offset); ++lhs, ++rhs)
-                    op(*lhs, *rhs);
+        std::complex<T> *dst = p_data;
+        for (int y = 0; y < mat.rows; ++y) {
+            const T *row_ptr = mat.ptr<T>(y);
+            for (int x = 0; x < 2 * mat.cols; x += 2) {
+                *dst++ = std::complex<T>(row_ptr[x], row_ptr[x + 1]);
             }
         }
-
-        return result;
     }
-    ComplexMat_<T> mat_const_operator(const std::function<void(std::complex<T> &c_rhs)> &op) const
+
+    // Evaluate the expression into this matrix. Elements are only ever
+    // read at the index being written, so the destination may appear in
+    // the expression, unless the assignment changes its size.
+    template <typename E> void assign(const E &expr)
     {
-        ComplexMat_<T> result = *this;
-        for (uint i = 0; i < n_channels; ++i)
-            for (auto lhs = result.p_data.begin() + i * rows * cols;
-                 lhs != result.p_data.begin() + (i + 1) * rows * cols; ++lhs)
-                op(*lhs);
-        return result;
+        if (expr.aliases(p_data) && num_elem() != size_t(expr.n_channels) * expr.rows * expr.cols) {
+            ComplexMat_<T> tmp(expr);
+            *this = std::move(tmp);
+            return;
+        }
+        if (assign_simd(*this, expr))
+            return;
+        create(expr.rows, expr.cols, expr.n_channels, expr.n_scales);
+
+        const uint n = rows * cols;
+        for (uint ch = 0; ch < n_channels; ++ch) {
+            std::complex<T> *dst = p_data + ch * n;
+            for (uint i = 0; i < n; ++i)
+                dst[i] = expr(ch, i);
+        }
     }
 
     cv::Mat channel_to_cv_mat(int channel_id) const
     {
-        cv::Mat result(rows, cols, CV_32FC2);
-        for (uint y = 0; y < rows; ++y) {
-            std::complex<T> *row_ptr = result.ptr<std::complex<T>>(y);
-            for (uint x = 0; x < cols; ++x) {
-                row_ptr[x] = p_data[channel_id * rows * cols + y * cols + x];
-            }
-        }
+        cv::Mat result;
+        to_cv_mat(uint(channel_id), result);
         return result;
     }
 };
 
 typedef ComplexMat_<float> ComplexMat;
 
+inline float *simd_data(const ComplexMat &m)
+{
+    return reinterpret_cast<float *>(m.get_p_data());
+}
+
+inline bool assign_simd(ComplexMat &dst, const ComplexMatBinary<ComplexMat, ComplexMat, ComplexMulOp> &e)
+{
+    dst.create(e.rows, e.cols, e.n_channels, e.n_scales);
+    simd_kernels().cmul(simd_data(dst), simd_data(e.lhs), simd_data(e.rhs), size_t(e.n_channels) * e.rows * e.cols);
+    return true;
+}
+
+inline bool assign_simd(ComplexMat &dst,
+                        const ComplexMatBinary<ComplexMat, ComplexMatUnary<ComplexMat, ComplexConjOp>, ComplexMulOp> &e)
+{
+    dst.create(e.rows, e.cols, e.n_channels, e.n_scales);
+    simd_kernels().cmul_conj(simd_data(dst), simd_data(e.lhs), simd_data(e.rhs.expr),
+                             size_t(e.n_channels) * e.rows * e.cols);
+    return true;
+}
+
+inline bool assign_simd(ComplexMat &dst, const ComplexMatBinary<ComplexMat, ComplexMat, ComplexDivOp> &e)
+{
+    dst.create(e.rows, e.cols, e.n_channels, e.n_scales);
+    simd_kernels().cdiv(simd_data(dst), simd_data(e.lhs), simd_data(e.rhs), size_t(e.n_channels) * e.rows * e.cols);
+    return true;
+}
+
+inline bool assign_simd(ComplexMat &dst,
+                        const ComplexMatBinary<ComplexMatScalar<ComplexMat, ComplexScaleOp>,
+                                               ComplexMatScalar<ComplexMat, ComplexScaleOp>, ComplexAddOp> &e)
+{
+    dst.create(e.rows, e.cols, e.n_channels, e.n_scales);
+    simd_kernels().axpby(simd_data(dst), e.lhs.scalar, simd_data(e.lhs.expr), e.rhs.scalar, simd_data(e.rhs.expr),
+                         size_t(e.n_channels) * e.rows * e.cols);
+    return true;
+}
+
+inline bool assign_simd(ComplexMat &dst, const ComplexMatBroadcast<ComplexMat, ComplexMat, ComplexMulOp> &e)
+{
+    const size_t n = size_t(e.rows) * e.cols;
+    dst.create(e.rows, e.cols, e.n_channels, e.n_scales);
+    for (uint ch = 0; ch < e.n_channels; ++ch)
+        simd_kernels().cmul(simd_data(dst) + 2 * ch * n, simd_data(e.lhs) + 2 * ch * n, simd_data(e.rhs), n);
+    return true;
+}
+
+inline bool assign_simd(
+    ComplexMat &dst,
+    const ComplexMatBroadcastScales<ComplexMat, ComplexMatUnary<ComplexMat, ComplexConjOp>, ComplexMulOp> &e)
+{
+    const size_t n = size_t(e.rows) * e.cols;
+    const uint n_rhs = e.rhs.expr.n_channels;
+    dst.create(e.rows, e.cols, e.n_channels, e.n_scales);
+    for (uint ch = 0; ch < e.n_channels; ++ch)
+        simd_kernels().cmul_conj(simd_data(dst) + 2 * ch * n, simd_data(e.lhs) + 2 * ch * n,
+                                 simd_data(e.rhs.expr) + 2 * (ch % n_rhs) * n, n);
+    return true;
+}
+
+inline bool assign_simd(ComplexMat &dst, const ComplexMatChannelSum<ComplexMat> &e)
+{
+    const size_t n = size_t(e.rows) * e.cols;
+    const uint n_per_scale = e.expr.n_channels / e.expr.n_scales;
+    dst.create(e.rows, e.cols, e.n_channels, e.n_scales);
+    for (uint scale = 0; scale < e.n_channels; ++scale) {
+        float *out = simd_data(dst) + 2 * scale * n;
+        const float *in = simd_data(e.expr) + 2 * scale * n_per_scale * n;
+        std::copy(in, in + 2 * n, out);
+        for (uint ch = 1; ch < n_per_scale; ++ch)
+            simd_kernels().accumulate(out, in + 2 * ch * n, n);
+    }
+    return true;
+}
+
+// Fused multiplication and sum over channels, channel ch of scale s of
+// the lhs is multiplied by rhs channel ch + s * rhs_scale_step.
+inline void mul_sum_over_channels_simd(ComplexMat &dst, const ComplexMat &lhs, const ComplexMat &rhs,
+                                       uint rhs_scale_step, bool conj)
+{
+    const SimdKernels &k = simd_kernels();
+    const size_t n = size_t(lhs.rows) * lhs.cols;
+    const uint n_per_scale = lhs.n_channels / lhs.n_scales;
+    dst.create(lhs.rows, lhs.cols, lhs.n_scales, 1);
+    for (uint scale = 0; scale < lhs.n_scales; ++scale) {
+        float *out = simd_data(dst) + 2 * scale * n;
+        const float *a = simd_data(lhs) + 2 * scale * n_per_scale * n;
+        const float *b = simd_data(rhs) + 2 * scale * rhs_scale_step * n;
+        (conj ? k.cmul_conj : k.cmul)(out, a, b, n);
+        for (uint ch = 1; ch < n_per_scale; ++ch)
+            (conj ? k.cmul_conj_acc : k.cmul_acc)(out, a + 2 * ch * n, b + 2 * ch * n, n);
+    }
+}
+
+inline bool assign_simd(ComplexMat &dst,
+                        const ComplexMatChannelSum<ComplexMatBinary<ComplexMat, ComplexMat, ComplexMulOp>> &e)
+{
+    if (e.expr.lhs.aliases(dst.get_p_data()) || e.expr.rhs.aliases(dst.get_p_data()))
+        return false;
+    mul_sum_over_channels_simd(dst, e.expr.lhs, e.expr.rhs, e.expr.n_channels / e.expr.n_scales, false);
+    return true;
+}
+
+inline bool
+assign_simd(ComplexMat &dst,
+            const ComplexMatChannelSum<ComplexMatBroadcastScales<ComplexMat, ComplexMat, ComplexMulOp>> &e)
+{
+    if (e.expr.lhs.aliases(dst.get_p_data()) || e.expr.rhs.aliases(dst.get_p_data()))
+        return false;
+    mul_sum_over_channels_simd(dst, e.expr.lhs, e.expr.rhs, 0, false);
+    return true;
+}
+
+inline bool assign_simd(ComplexMat &dst,
+                        const ComplexMatChannelSum<ComplexMatBroadcastScales<
+                            ComplexMat, ComplexMatUnary<ComplexMat, ComplexConjOp>, ComplexMulOp>> &e)
+{
+    if (e.expr.lhs.aliases(dst.get_p_data()) || e.expr.rhs.expr.aliases(dst.get_p_data()))
+        return false;
+    mul_sum_over_channels_simd(dst, e.expr.lhs, e.expr.rhs.expr, 0, true);
+    return true;
+}
+
+inline bool assign_simd(ComplexMat &dst, const ComplexMatChannelSum<ComplexMatUnary<ComplexMat, ComplexSqrMagOp>> &e)
+{
+    if (e.expr.expr.aliases(dst.get_p_data()))
+        return false;
+    // |x|^2 == x * conj(x)
+    mul_sum_over_channels_simd(dst, e.expr.expr, e.expr.expr, e.expr.n_channels / e.expr.n_scales, true);
+    return true;
+}
+
 #endif // COMPLEX_MAT_HPP_213123048309482094
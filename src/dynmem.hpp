@@ -2,6 +2,7 @@
 #define DYNMEM_HPP
 
 #include <cstdlib>
+#include <new>
 
 #if defined(CUFFT) || defined(CUFFTW)
 #include "cuda_runtime.h"
@@ -10,9 +11,97 @@
 #endif
 #endif
 
+// Alignment of all working buffers (one cache line, enough for AVX-512)
+#define DYNMEM_ALIGNMENT 64
+
+inline size_t dynmem_align(size_t size)
+{
+    return (size + DYNMEM_ALIGNMENT - 1) & ~size_t(DYNMEM_ALIGNMENT - 1);
+}
+
+inline void *dynmem_malloc(size_t size)
+{
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, DYNMEM_ALIGNMENT, dynmem_align(size ? size : 1)) != 0)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+inline void dynmem_free(void *ptr)
+{
+    std::free(ptr);
+}
+
+// One contiguous block of memory from which all working buffers of a
+// tracker are carved. The block is allocated by reserve() (typically once
+// in KCF_Tracker::init()) and released as a whole. Every region is
+// DYNMEM_ALIGNMENT aligned. With CUFFT, the block is mapped page-locked
+// host memory, so that each region has its device counterpart.
+class Arena {
+    char *base = nullptr;
+    char *base_d = nullptr;
+    size_t capacity = 0, used = 0;
+
+  public:
+    Arena() {}
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena() { release(); }
+
+    // Drop all regions and make room for size bytes
+    void reserve(size_t size)
+    {
+        used = 0;
+        if (size <= capacity)
+            return;
+        release();
+#ifdef CUFFT
+        CudaSafeCall(cudaHostAlloc(reinterpret_cast<void **>(&base), size, cudaHostAllocMapped));
+        CudaSafeCall(cudaHostGetDevicePointer(reinterpret_cast<void **>(&base_d), reinterpret_cast<void *>(base), 0));
+#else
+        base = static_cast<char *>(dynmem_malloc(size));
+#endif
+        capacity = size;
+    }
+
+    // Return an aligned region of size bytes
+    void *alloc(size_t size)
+    {
+        size = dynmem_align(size);
+        if (used + size > capacity)
+            throw std::bad_alloc();
+        void *ptr = base + used;
+        used += size;
+        return ptr;
+    }
+
+    // Device address of a region returned by alloc() (CUFFT only)
+    void *device_ptr(void *ptr) const
+    {
+        return base_d ? base_d + (static_cast<char *>(ptr) - base) : nullptr;
+    }
+
+    size_t size() const { return capacity; }
+
+  private:
+    void release()
+    {
+#ifdef CUFFT
+        if (base)
+            CudaSafeCall(cudaFreeHost(base));
+#else
+        dynmem_free(base);
+#endif
+        base = base_d = nullptr;
+        capacity = used = 0;
+    }
+};
+
+// Buffer of size bytes, either owned or allocated from an Arena
 template <typename T> class DynMem_ {
     T *ptr = nullptr;
     T *ptr_d = nullptr;
+    bool foreign_data = false;
 
   public:
     DynMem_()
@@ -24,35 +113,52 @@ template <typename T> class DynMem_ {
         CudaSafeCall(
             cudaHostGetDevicePointer(reinterpret_cast<void **>(&this->ptr_d), reinterpret_cast<void *>(this->ptr), 0));
 #else
-        this->ptr = new float[size];
+        this->ptr = static_cast<T *>(dynmem_malloc(size));
 #endif
     }
+    DynMem_(size_t size, Arena &arena)
+    {
+        this->ptr = static_cast<T *>(arena.alloc(size));
+        this->ptr_d = static_cast<T *>(arena.device_ptr(this->ptr));
+        this->foreign_data = true;
+    }
     DynMem_(DynMem_&& other) {
         this->ptr = other.ptr;
         this->ptr_d = other.ptr_d;
+        this->foreign_data = other.foreign_data;
 
         other.ptr = nullptr;
         other.ptr_d = nullptr;
     }
     ~DynMem_()
     {
-#ifdef CUFFT
-        CudaSafeCall(cudaFreeHost(this->ptr));
-#else
-        delete this->ptr;
-#endif
+        release();
     }
     T *hostMem() { return ptr; }
     T *deviceMem() { return ptr_d; }
 
     void operator=(DynMem_ &&rhs)
     {
+        release();
         this->ptr = rhs.ptr;
         this->ptr_d = rhs.ptr_d;
+        this->foreign_data = rhs.foreign_data;
 
         rhs.ptr = nullptr;
         rhs.ptr_d = nullptr;
     }
+
+  private:
+    void release()
+    {
+        if (!this->ptr || this->foreign_data)
+            return;
+#ifdef CUFFT
+        CudaSafeCall(cudaFreeHost(this->ptr));
+#else
+        dynmem_free(this->ptr);
+#endif
+    }
 };
 typedef DynMem_<float> DynMem;
 #endif // DYNMEM_HPP
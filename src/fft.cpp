@@ -1,6 +1,183 @@
-
 #include "fft.h"
 
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+#ifdef CUFFT
+#include "fft_cufft.h"
+#else
+#include "fft_opencv.h"
+#include "fft_builtin.hpp"
+#endif
+#ifdef FFTW
+#include "fft_fftw.h"
+#endif
+
+std::vector<std::string> Fft::implementations()
+{
+#ifdef CUFFT
+    return {"cufft"};
+#elif defined(FFTW) && defined(BIG_BATCH)
+    // FftOpencv cannot transform all scales at once
+    return {Fftw().name(), "builtin"};
+#elif defined(FFTW)
+    return {Fftw().name(), "opencv", "builtin"};
+#else
+    return {"opencv", "builtin"};
+#endif
+}
+
+Fft *Fft::create(const std::string &name)
+{
+    std::vector<std::string> names = implementations();
+    const std::string &impl = name.empty() ? names.front() : name;
+    if (std::find(names.begin(), names.end(), impl) == names.end())
+        return nullptr;
+#ifdef CUFFT
+    return new cuFFT();
+#else
+    if (impl == "builtin")
+        return new FftBuiltin();
+#ifdef FFTW
+    if (impl != "opencv")
+        return new Fftw();
+#endif
+    return new FftOpencv();
+#endif
+}
+
+double Fft::benchmark(const std::string &name, unsigned width, unsigned height, unsigned num_of_feats,
+                      unsigned num_of_scales)
+{
+#ifdef CUFFT
+    // the cuFFT transforms work on device memory and streams of the tracker
+    (void)name;
+    (void)width;
+    (void)height;
+    (void)num_of_feats;
+    (void)num_of_scales;
+    return -1;
+#else
+    std::unique_ptr<Fft> fft(create(name));
+    if (!fft)
+        return -1;
+
+    // The transforms of one scale in KCF_Tracker::scale_track(): the
+    // features forward, and in the Gaussian correlation an inverse and a
+    // forward of one channel followed by the inverse of the response.
+    cv::Mat feats(int(height * num_of_feats), int(width), CV_32F), real(int(height), int(width), CV_32F);
+    cv::randu(feats, -1.f, 1.f);
+    cv::randu(real, -1.f, 1.f);
+
+    fft->init(width, height, num_of_feats, num_of_scales);
+    unsigned cols = fft->spectrum_width(width);
+    ComplexMat feats_f(height, cols, num_of_feats), real_f(height, cols, 1);
+    cv::Mat result(int(height), int(width), CV_32F);
+
+    double time = std::numeric_limits<double>::max();
+    for (int i = 0; i < 5; ++i) { // the first run warms up
+        int64 start = cv::getTickCount();
+        fft->forward_window(feats, feats_f, nullptr, nullptr);
+        fft->inverse(real_f, result, nullptr, nullptr);
+        fft->forward(real, real_f, nullptr, nullptr);
+        fft->inverse(real_f, result, nullptr, nullptr);
+        double t = double(cv::getTickCount() - start) / cv::getTickFrequency();
+        if (i > 0)
+            time = std::min(time, t);
+    }
+    return time;
+#endif
+}
+
+std::string Fft::fastest(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales)
+{
+    std::vector<std::string> names = implementations();
+    if (names.size() == 1)
+        return names.front();
+
+    std::string best;
+    double best_time = std::numeric_limits<double>::max();
+    for (const std::string &name : names) {
+        double time = benchmark(name, width, height, num_of_feats, num_of_scales);
+        std::cout << "FFT: " << name << " takes " << time * 1000 << " ms per scale" << std::endl;
+        if (time < best_time) {
+            best_time = time;
+            best = name;
+        }
+    }
+    return best;
+}
+
+bool Fft::load_wisdom(const std::string &file)
+{
+#ifdef FFTW
+    return Fftw::load_wisdom(file);
+#else
+    (void)file;
+    return true;
+#endif
+}
+
+bool Fft::save_wisdom(const std::string &file)
+{
+#ifdef FFTW
+    return Fftw::save_wisdom(file);
+#else
+    (void)file;
+    return true;
+#endif
+}
+
+bool Fft::check_buffer(const cv::Mat &real, const char *what) const
+{
+    if (real.depth() != CV_32F || !real.isContinuous()) {
+        std::cerr << "FFT: " << what << " is not a continuous float matrix" << std::endl;
+        return false;
+    }
+    if (!is_aligned(real.data)) {
+        std::cerr << "FFT: " << what << " is not aligned as " << name() << " requires" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Fft::check_buffer(const ComplexMat &spectrum, const char *what) const
+{
+    if (!is_aligned(spectrum.get_p_data())) {
+        std::cerr << "FFT: " << what << " is not aligned as " << name() << " requires" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Fft::check_buffers(const ThreadCtx &ctx) const
+{
+#ifdef CUFFT
+    // the transforms run on the device copies of the buffers
+    (void)ctx;
+    return true;
+#else
+    // all of them are checked, so that every problem is reported
+    bool ok = check_buffer(ctx.fw_all, "fw_all");
+    ok = check_buffer(ctx.in_all, "in_all") && ok;
+    ok = check_buffer(ctx.ifft2_res, "ifft2_res") && ok;
+    ok = check_buffer(ctx.response, "response") && ok;
+    ok = check_buffer(ctx.zf, "zf") && ok;
+    ok = check_buffer(ctx.kzf, "kzf") && ok;
+    ok = check_buffer(ctx.kf, "kf") && ok;
+    ok = check_buffer(ctx.xyf, "xyf") && ok;
+    return ok;
+#endif
+}
+
+void Fft::forward_window_batch(const WindowJob *jobs, size_t n_jobs)
+{
+    for (size_t i = 0; i < n_jobs; ++i)
+        forward_window(*jobs[i].patch_feats, *jobs[i].result, jobs[i].real_input_arr, jobs[i].stream);
+}
+
 Fft::~Fft()
 {
 
@@ -3,6 +3,7 @@
 #define FFT_H
 
 #include <opencv2/opencv.hpp>
+#include <string>
 #include <vector>
 #include "threadctx.hpp"
 
@@ -21,12 +22,69 @@
 class Fft
 {
 public:
+    // A forward_window() transform, see forward_window_batch()
+    struct WindowJob {
+        const cv::Mat *patch_feats;
+        ComplexMat *result;
+        float *real_input_arr;
+        cudaStream_t stream;
+    };
+
+    // Names of the FFT implementations compiled in, the default one first
+    static std::vector<std::string> implementations();
+    // New object of the implementation called name, of the default one if
+    // name is empty. Returns nullptr for unknown names.
+    static Fft *create(const std::string & name = "");
+    // Seconds the implementation called name needs for the transforms of
+    // one tracked scale of the given window size (the best of several
+    // runs), or a negative number for unknown names and in cuFFT builds
+    static double benchmark(const std::string & name, unsigned width, unsigned height, unsigned num_of_feats,
+                            unsigned num_of_scales);
+    // Name of the implementation that executes the transforms of one
+    // tracked scale fastest for the given window size, measured by running
+    // each of them. They are initialized for this size on the way.
+    static std::string fastest(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales);
+    // Load or save the planner state of the FFT library, so that later
+    // runs plan quickly. They return false on failure and do nothing if
+    // the library has no such state.
+    static bool load_wisdom(const std::string & file);
+    static bool save_wisdom(const std::string & file);
+
+    virtual const char *name() const = 0;
+    // Columns of the ComplexMat spectra of width columns wide inputs
+    virtual unsigned spectrum_width(unsigned width) const { return width; }
+
     virtual void init(unsigned width, unsigned height,unsigned num_of_feats, unsigned num_of_scales) = 0;
-    virtual void set_window(const cv::Mat & window) = 0;
+    // Check, when a context is created, that its buffers can be passed to
+    // the transforms: real images must be continuous float matrices and
+    // all arrays must be aligned as the implementation requires. The
+    // problems are printed, false is returned if there are any.
+    bool check_buffers(const ThreadCtx & ctx) const;
+    bool check_buffer(const cv::Mat & real, const char *what) const;
+    bool check_buffer(const ComplexMat & spectrum, const char *what) const;
     virtual void forward(const cv::Mat & real_input, ComplexMat & complex_result, float *real_input_arr, cudaStream_t  stream) = 0;
-    virtual void forward_window(std::vector<cv::Mat> patch_feats, ComplexMat & complex_result, cv::Mat & fw_all, float *real_input_arr, cudaStream_t stream) = 0;
+    // Forward FFT of the feature channels stacked vertically in patch_feats
+    // (n_channels * height rows), which are already multiplied by the window.
+    virtual void forward_window(const cv::Mat & patch_feats, ComplexMat & complex_result, float *real_input_arr, cudaStream_t stream) = 0;
+    // Inverse FFT without the 1 / (width * height) normalization, like
+    // FFTW's c2r transforms. Callers fold the factor into their constants.
     virtual void inverse(ComplexMat &  complex_input, cv::Mat & real_result, float *real_result_arr, cudaStream_t stream) = 0;
+
+    // Prepares forward_window_batch() to transform n_windows windows at
+    // once. Implementations without batched plans ignore it.
+    virtual void init_batch(unsigned n_windows) { (void)n_windows; }
+    // Executes the forward_window() jobs, possibly of different trackers,
+    // with the window size and number of features given to init(). There is
+    // no batched inverse: the transforms after the forward one have a single
+    // channel per scale (the channels are summed before the inverse) and
+    // each needs the result of the previous one, so batching them would
+    // synchronize the trackers twice more per frame for little work.
+    virtual void forward_window_batch(const WindowJob *jobs, size_t n_jobs);
     virtual ~Fft() = 0;
+
+protected:
+    // Whether the transforms may read or write an array starting at data
+    virtual bool is_aligned(const void *data) const { (void)data; return true; }
 };
 
 #endif // FFT_H
@@ -0,0 +1,499 @@
+#ifndef FFT_BUILTIN_HPP
+#define FFT_BUILTIN_HPP
+
+// FFT implementation without dependencies, for builds without FFTW. It is
+// tuned for the small windows of the tracker: a mixed-radix (4, 2, 3, 5 and
+// generic) Stockham transform on separate real and imaginary arrays, which
+// transforms many rows or columns at once, so that the butterflies are
+// loops over contiguous memory, vectorized by the compiler.
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "fft.h"
+#include "pragmas.h"
+
+namespace builtin_fft {
+
+// Batched complex transforms of length n. The data is stored as n vectors
+// of batch numbers each, i.e. element t of transform j is at t * batch + j,
+// with the real and imaginary parts in separate arrays.
+class Plan1d
+{
+  public:
+    explicit Plan1d(unsigned n) : n(n)
+    {
+        unsigned m = n;
+        for (unsigned p : {4u, 2u, 3u, 5u})
+            for (; m % p == 0; m /= p)
+                radices.push_back(p);
+        for (unsigned p = 7; m > 1; p += 2)
+            for (; m % p == 0; m /= p)
+                radices.push_back(p);
+
+        // twiddles exp(-2 pi i t1 r / n_cur) of each stage (see execute())
+        unsigned n_cur = n;
+        for (unsigned p : radices) {
+            unsigned s = n_cur / p;
+            Stage stage{p, s, {}, {}, {}, {}};
+            for (unsigned t1 = 0; t1 < s; ++t1)
+                for (unsigned r = 1; r < p; ++r) {
+                    double a = -2 * M_PI * t1 * r / n_cur;
+                    stage.tw_re.push_back(float(std::cos(a)));
+                    stage.tw_im.push_back(float(std::sin(a)));
+                }
+            for (unsigned q = 0; q < p * p; ++q) {
+                double a = -2 * M_PI * (q / p) * (q % p) / p;
+                stage.dft_re.push_back(float(std::cos(a)));
+                stage.dft_im.push_back(float(std::sin(a)));
+            }
+            stages.push_back(stage);
+            n_cur = s;
+        }
+    }
+
+    unsigned size() const { return n; }
+
+    // Transforms the data in (re, im) using (tmp_re, tmp_im) of the same
+    // size as scratch. The result is in one of the two pairs, which is
+    // returned in (re, im).
+    void execute(float *&re, float *&im, float *&tmp_re, float *&tmp_im, size_t batch, bool inverse) const
+    {
+        // Stage with radix p splits each of the L transforms of length
+        // n_cur = p * s into p transforms of length s, input element
+        // t1 + s * q of transform b becomes element t1 of transform
+        // b + L * r, see the Stockham autosort algorithm.
+        size_t L = 1;
+        for (const Stage &stage : stages) {
+            const unsigned p = stage.p, s = stage.s;
+            const size_t len = L * batch; // contiguous numbers with the same twiddles
+            for (unsigned t1 = 0; t1 < s; ++t1) {
+                const float *tw_re = &stage.tw_re[t1 * (p - 1)];
+                const float *tw_im = &stage.tw_im[t1 * (p - 1)];
+                const float *in_re = re + t1 * len, *in_im = im + t1 * len;
+                float *out_re = tmp_re + t1 * p * len, *out_im = tmp_im + t1 * p * len;
+                const size_t in_stride = s * len;
+                switch (p) {
+                case 2: radix2(in_re, in_im, in_stride, out_re, out_im, len, tw_re, tw_im, inverse); break;
+                case 3: radix3(in_re, in_im, in_stride, out_re, out_im, len, tw_re, tw_im, inverse); break;
+                case 4: radix4(in_re, in_im, in_stride, out_re, out_im, len, tw_re, tw_im, inverse); break;
+                case 5: radix5(in_re, in_im, in_stride, out_re, out_im, len, tw_re, tw_im, inverse); break;
+                default:
+                    generic(stage, in_re, in_im, in_stride, out_re, out_im, len, tw_re, tw_im, inverse);
+                }
+            }
+            std::swap(re, tmp_re);
+            std::swap(im, tmp_im);
+            L *= p;
+        }
+    }
+
+  private:
+    struct Stage {
+        unsigned p, s;
+        std::vector<float> tw_re, tw_im;   // (s, p - 1)
+        std::vector<float> dft_re, dft_im; // (p, p), for the generic radix
+    };
+
+    unsigned n;
+    std::vector<unsigned> radices;
+    std::vector<Stage> stages;
+
+    // The butterflies compute out_r = tw_r * sum_q in_q * w_p^(q r) for the
+    // n numbers of the p inputs in_q = in + q * in_stride and outputs
+    // out_r = out + r * n. The inverse uses the conjugated roots of unity.
+    // The inputs and outputs never overlap, which VECTORIZED_LOOP tells
+    // the compiler.
+
+    static void radix2(const float *in_re, const float *in_im, size_t in_stride, float *out_re, float *out_im,
+                       size_t n, const float *tw_re, const float *tw_im, bool inverse)
+    {
+        const float *a0_re = in_re, *a0_im = in_im;
+        const float *a1_re = in_re + in_stride, *a1_im = in_im + in_stride;
+        float *o0_re = out_re, *o0_im = out_im;
+        float *o1_re = out_re + n, *o1_im = out_im + n;
+        const float w1r = tw_re[0], w1i = inverse ? -tw_im[0] : tw_im[0];
+        VECTORIZED_LOOP
+        for (size_t i = 0; i < n; ++i) {
+            float a0r = a0_re[i], a0i = a0_im[i], a1r = a1_re[i], a1i = a1_im[i];
+            o0_re[i] = a0r + a1r;
+            o0_im[i] = a0i + a1i;
+            float xr = a0r - a1r, xi = a0i - a1i;
+            o1_re[i] = xr * w1r - xi * w1i;
+            o1_im[i] = xr * w1i + xi * w1r;
+        }
+    }
+
+    static void radix3(const float *in_re, const float *in_im, size_t in_stride, float *out_re, float *out_im,
+                       size_t n, const float *tw_re, const float *tw_im, bool inverse)
+    {
+        const float *a0_re = in_re, *a0_im = in_im;
+        const float *a1_re = in_re + in_stride, *a1_im = in_im + in_stride;
+        const float *a2_re = in_re + 2 * in_stride, *a2_im = in_im + 2 * in_stride;
+        float *o0_re = out_re, *o0_im = out_im;
+        float *o1_re = out_re + n, *o1_im = out_im + n;
+        float *o2_re = out_re + 2 * n, *o2_im = out_im + 2 * n;
+        const float sg = inverse ? -1.f : 1.f, s3 = sg * 0.86602540378443864676f;
+        const float w1r = tw_re[0], w1i = sg * tw_im[0], w2r = tw_re[1], w2i = sg * tw_im[1];
+        VECTORIZED_LOOP
+        for (size_t i = 0; i < n; ++i) {
+            float a0r = a0_re[i], a0i = a0_im[i], a1r = a1_re[i], a1i = a1_im[i], a2r = a2_re[i], a2i = a2_im[i];
+            float t1r = a1r + a2r, t1i = a1i + a2i;
+            float t2r = a0r - 0.5f * t1r, t2i = a0i - 0.5f * t1i;
+            // -i * s3 * (a1 - a2)
+            float t3r = s3 * (a1i - a2i), t3i = -s3 * (a1r - a2r);
+            o0_re[i] = a0r + t1r;
+            o0_im[i] = a0i + t1i;
+            float xr = t2r + t3r, xi = t2i + t3i;
+            o1_re[i] = xr * w1r - xi * w1i;
+            o1_im[i] = xr * w1i + xi * w1r;
+            xr = t2r - t3r, xi = t2i - t3i;
+            o2_re[i] = xr * w2r - xi * w2i;
+            o2_im[i] = xr * w2i + xi * w2r;
+        }
+    }
+
+    static void radix4(const float *in_re, const float *in_im, size_t in_stride, float *out_re, float *out_im,
+                       size_t n, const float *tw_re, const float *tw_im, bool inverse)
+    {
+        const float *a0_re = in_re, *a0_im = in_im;
+        const float *a1_re = in_re + in_stride, *a1_im = in_im + in_stride;
+        const float *a2_re = in_re + 2 * in_stride, *a2_im = in_im + 2 * in_stride;
+        const float *a3_re = in_re + 3 * in_stride, *a3_im = in_im + 3 * in_stride;
+        float *o0_re = out_re, *o0_im = out_im;
+        float *o1_re = out_re + n, *o1_im = out_im + n;
+        float *o2_re = out_re + 2 * n, *o2_im = out_im + 2 * n;
+        float *o3_re = out_re + 3 * n, *o3_im = out_im + 3 * n;
+        const float sg = inverse ? -1.f : 1.f;
+        const float w1r = tw_re[0], w1i = sg * tw_im[0], w2r = tw_re[1], w2i = sg * tw_im[1];
+        const float w3r = tw_re[2], w3i = sg * tw_im[2];
+        VECTORIZED_LOOP
+        for (size_t i = 0; i < n; ++i) {
+            float a0r = a0_re[i], a0i = a0_im[i], a1r = a1_re[i], a1i = a1_im[i];
+            float a2r = a2_re[i], a2i = a2_im[i], a3r = a3_re[i], a3i = a3_im[i];
+            float s02r = a0r + a2r, s02i = a0i + a2i, d02r = a0r - a2r, d02i = a0i - a2i;
+            float s13r = a1r + a3r, s13i = a1i + a3i;
+            // -i * sg * (a1 - a3)
+            float d13r = sg * (a1i - a3i), d13i = -sg * (a1r - a3r);
+            o0_re[i] = s02r + s13r;
+            o0_im[i] = s02i + s13i;
+            float xr = d02r + d13r, xi = d02i + d13i;
+            o1_re[i] = xr * w1r - xi * w1i;
+            o1_im[i] = xr * w1i + xi * w1r;
+            xr = s02r - s13r, xi = s02i - s13i;
+            o2_re[i] = xr * w2r - xi * w2i;
+            o2_im[i] = xr * w2i + xi * w2r;
+            xr = d02r - d13r, xi = d02i - d13i;
+            o3_re[i] = xr * w3r - xi * w3i;
+            o3_im[i] = xr * w3i + xi * w3r;
+        }
+    }
+
+    static void radix5(const float *in_re, const float *in_im, size_t in_stride, float *out_re, float *out_im,
+                       size_t n, const float *tw_re, const float *tw_im, bool inverse)
+    {
+        const float *a0_re = in_re, *a0_im = in_im;
+        const float *a1_re = in_re + in_stride, *a1_im = in_im + in_stride;
+        const float *a2_re = in_re + 2 * in_stride, *a2_im = in_im + 2 * in_stride;
+        const float *a3_re = in_re + 3 * in_stride, *a3_im = in_im + 3 * in_stride;
+        const float *a4_re = in_re + 4 * in_stride, *a4_im = in_im + 4 * in_stride;
+        float *o0_re = out_re, *o0_im = out_im;
+        float *o1_re = out_re + n, *o1_im = out_im + n;
+        float *o2_re = out_re + 2 * n, *o2_im = out_im + 2 * n;
+        float *o3_re = out_re + 3 * n, *o3_im = out_im + 3 * n;
+        float *o4_re = out_re + 4 * n, *o4_im = out_im + 4 * n;
+        const float sg = inverse ? -1.f : 1.f;
+        const float c1 = 0.30901699437494742410f, c2 = -0.80901699437494742410f;
+        const float s1 = sg * 0.95105651629515357212f, s2 = sg * 0.58778525229247312917f;
+        const float w1r = tw_re[0], w1i = sg * tw_im[0], w2r = tw_re[1], w2i = sg * tw_im[1];
+        const float w3r = tw_re[2], w3i = sg * tw_im[2], w4r = tw_re[3], w4i = sg * tw_im[3];
+        VECTORIZED_LOOP
+        for (size_t i = 0; i < n; ++i) {
+            float a0r = a0_re[i], a0i = a0_im[i];
+            float b1r = a1_re[i] + a4_re[i], b1i = a1_im[i] + a4_im[i];
+            float d1r = a1_re[i] - a4_re[i], d1i = a1_im[i] - a4_im[i];
+            float b2r = a2_re[i] + a3_re[i], b2i = a2_im[i] + a3_im[i];
+            float d2r = a2_re[i] - a3_re[i], d2i = a2_im[i] - a3_im[i];
+            float e1r = a0r + c1 * b1r + c2 * b2r, e1i = a0i + c1 * b1i + c2 * b2i;
+            float e2r = a0r + c2 * b1r + c1 * b2r, e2i = a0i + c2 * b1i + c1 * b2i;
+            // -i * (s1 d1 + s2 d2) and -i * (s2 d1 - s1 d2)
+            float f1r = s1 * d1i + s2 * d2i, f1i = -(s1 * d1r + s2 * d2r);
+            float f2r = s2 * d1i - s1 * d2i, f2i = -(s2 * d1r - s1 * d2r);
+            o0_re[i] = a0r + b1r + b2r;
+            o0_im[i] = a0i + b1i + b2i;
+            float xr = e1r + f1r, xi = e1i + f1i;
+            o1_re[i] = xr * w1r - xi * w1i;
+            o1_im[i] = xr * w1i + xi * w1r;
+            xr = e2r + f2r, xi = e2i + f2i;
+            o2_re[i] = xr * w2r - xi * w2i;
+            o2_im[i] = xr * w2i + xi * w2r;
+            xr = e2r - f2r, xi = e2i - f2i;
+            o3_re[i] = xr * w3r - xi * w3i;
+            o3_im[i] = xr * w3i + xi * w3r;
+            xr = e1r - f1r, xi = e1i - f1i;
+            o4_re[i] = xr * w4r - xi * w4i;
+            o4_im[i] = xr * w4i + xi * w4r;
+        }
+    }
+
+    static void generic(const Stage &stage, const float *in_re, const float *in_im,
+                        size_t in_stride, float *out_re, float *out_im, size_t n,
+                        const float *tw_re, const float *tw_im, bool inverse)
+    {
+        const unsigned p = stage.p;
+        const float sg = inverse ? -1.f : 1.f;
+        for (unsigned r = 0; r < p; ++r) {
+            float *o_re = out_re + r * n, *o_im = out_im + r * n;
+            VECTORIZED_LOOP
+            for (size_t i = 0; i < n; ++i) {
+                o_re[i] = in_re[i];
+                o_im[i] = in_im[i];
+            }
+            for (unsigned q = 1; q < p; ++q) {
+                const float wr = stage.dft_re[q * p + r], wi = sg * stage.dft_im[q * p + r];
+                const float *a_re = in_re + q * in_stride, *a_im = in_im + q * in_stride;
+                VECTORIZED_LOOP
+                for (size_t i = 0; i < n; ++i) {
+                    o_re[i] += a_re[i] * wr - a_im[i] * wi;
+                    o_im[i] += a_re[i] * wi + a_im[i] * wr;
+                }
+            }
+            if (r > 0) {
+                const float wr = tw_re[r - 1], wi = sg * tw_im[r - 1];
+                VECTORIZED_LOOP
+                for (size_t i = 0; i < n; ++i) {
+                    float xr = o_re[i], xi = o_im[i];
+                    o_re[i] = xr * wr - xi * wi;
+                    o_im[i] = xr * wi + xi * wr;
+                }
+            }
+        }
+    }
+};
+
+// Real 2D transforms of height x width images with width / 2 + 1 spectrum
+// columns, the layout of FFTW's r2c and c2r transforms. Several channels
+// are transformed together. The rows are transformed two at a time as the
+// real and imaginary part of one complex row, then the spectrum columns of
+// all channels at once.
+class Real2d
+{
+  public:
+    Real2d(unsigned width, unsigned height) : width(width), height(height), rows(width), cols(height) {}
+
+    unsigned spectrum_width() const { return width / 2 + 1; }
+
+    // Transforms n_channels images stacked vertically in in (rows in_step
+    // floats apart) to n_channels spectra, one after another, in out
+    void forward(const float *in, size_t in_step, unsigned n_channels, std::complex<float> *out) const
+    {
+        const size_t n_rows = size_t(height) * n_channels, n_pairs = (n_rows + 1) / 2;
+        const unsigned wc = spectrum_width();
+        const size_t col_batch = size_t(n_channels) * wc;
+        Scratch &buf = scratch(std::max(width * n_pairs, height * col_batch), n_rows);
+
+        float *re = buf.re.data(), *im = buf.im.data(), *tmp_re = buf.tmp_re.data(), *tmp_im = buf.tmp_im.data();
+        size_t *offset = buf.offset.data();
+        for (size_t r = 0; r < n_rows; ++r)
+            offset[r] = (r % height) * col_batch + (r / height) * wc;
+
+        // row pairs (as re, im) transposed to width x n_pairs, in blocks of
+        // rows that stay in the cache
+        for (size_t j0 = 0; j0 < n_pairs; j0 += k_block) {
+            const size_t j1 = std::min(n_pairs, j0 + k_block);
+            for (unsigned x = 0; x < width; ++x)
+                for (size_t j = j0; j < j1; ++j) {
+                    const float *r0 = in + 2 * j * in_step;
+                    re[x * n_pairs + j] = r0[x];
+                    im[x * n_pairs + j] = 2 * j + 1 < n_rows ? r0[in_step + x] : 0.f;
+                }
+        }
+        rows.execute(re, im, tmp_re, tmp_im, n_pairs, false);
+
+        // Z = X0 + i X1, so X0[k] = (Z[k] + conj(Z[-k])) / 2 and
+        // X1[k] = -i (Z[k] - conj(Z[-k])) / 2. The results go to
+        // height x (n_channels * wc) for the column transforms.
+        for (size_t j0 = 0; j0 < n_pairs; j0 += k_block) {
+            const size_t j1 = std::min(n_pairs, j0 + k_block);
+            for (unsigned k = 0; k < wc; ++k) {
+                const unsigned nk = (width - k) % width;
+                for (size_t j = j0; j < j1; ++j) {
+                    float zr = re[k * n_pairs + j], zi = im[k * n_pairs + j];
+                    float nr = re[nk * n_pairs + j], ni = -im[nk * n_pairs + j];
+                    const size_t i0 = offset[2 * j] + k;
+                    tmp_re[i0] = 0.5f * (zr + nr);
+                    tmp_im[i0] = 0.5f * (zi + ni);
+                    if (2 * j + 1 < n_rows) {
+                        const size_t i1 = offset[2 * j + 1] + k;
+                        tmp_re[i1] = 0.5f * (zi - ni);
+                        tmp_im[i1] = -0.5f * (zr - nr);
+                    }
+                }
+            }
+        }
+        std::swap(re, tmp_re);
+        std::swap(im, tmp_im);
+        cols.execute(re, im, tmp_re, tmp_im, col_batch, false);
+
+        for (unsigned ch = 0; ch < n_channels; ++ch)
+            for (unsigned y = 0; y < height; ++y) {
+                const size_t i = y * col_batch + ch * wc;
+                std::complex<float> *o = out + (size_t(ch) * height + y) * wc;
+                for (unsigned k = 0; k < wc; ++k)
+                    o[k] = std::complex<float>(re[i + k], im[i + k]);
+            }
+    }
+
+    // Transforms n_channels Hermitian spectra, one after another in in, to
+    // height x width images with the channels interleaved, not normalized
+    void inverse(const std::complex<float> *in, unsigned n_channels, float *out) const
+    {
+        const size_t n_rows = size_t(height) * n_channels, n_pairs = (n_rows + 1) / 2;
+        const unsigned wc = spectrum_width();
+        const size_t col_batch = size_t(n_channels) * wc;
+        Scratch &buf = scratch(std::max(width * n_pairs, height * col_batch), n_rows);
+
+        float *re = buf.re.data(), *im = buf.im.data(), *tmp_re = buf.tmp_re.data(), *tmp_im = buf.tmp_im.data();
+        size_t *offset = buf.offset.data();
+        for (size_t r = 0; r < n_rows; ++r)
+            offset[r] = (r % height) * col_batch + (r / height) * wc;
+        for (unsigned ch = 0; ch < n_channels; ++ch)
+            for (unsigned y = 0; y < height; ++y) {
+                const size_t i = y * col_batch + ch * wc;
+                const std::complex<float> *row = in + (size_t(ch) * height + y) * wc;
+                for (unsigned k = 0; k < wc; ++k) {
+                    re[i + k] = row[k].real();
+                    im[i + k] = row[k].imag();
+                }
+            }
+        cols.execute(re, im, tmp_re, tmp_im, col_batch, true);
+
+        // Z = X0 + i X1 with X[-k] = conj(X[k]) and real X[0] and
+        // X[width / 2], transposed to width x n_pairs
+        for (size_t j0 = 0; j0 < n_pairs; j0 += k_block) {
+            const size_t j1 = std::min(n_pairs, j0 + k_block);
+            for (unsigned k = 0; k < width; ++k) {
+                const unsigned kk = k < wc ? k : width - k;
+                const bool real = k == 0 || 2 * k == width;
+                const float sg = real ? 0.f : k < wc ? 1.f : -1.f;
+                for (size_t j = j0; j < j1; ++j) {
+                    const size_t i0 = offset[2 * j] + kk;
+                    float x0r = re[i0], x0i = sg * im[i0];
+                    float x1r = 0.f, x1i = 0.f;
+                    if (2 * j + 1 < n_rows) {
+                        const size_t i1 = offset[2 * j + 1] + kk;
+                        x1r = re[i1];
+                        x1i = sg * im[i1];
+                    }
+                    tmp_re[k * n_pairs + j] = x0r - x1i;
+                    tmp_im[k * n_pairs + j] = x0i + x1r;
+                }
+            }
+        }
+        std::swap(re, tmp_re);
+        std::swap(im, tmp_im);
+        rows.execute(re, im, tmp_re, tmp_im, n_pairs, true);
+
+        for (size_t r0 = 0; r0 < n_rows; r0 += 2 * k_block) {
+            const size_t r1 = std::min(n_rows, r0 + 2 * k_block);
+            for (unsigned x = 0; x < width; ++x)
+                for (size_t r = r0; r < r1; ++r) {
+                    const float *src = r % 2 ? im : re;
+                    out[(r % height) * size_t(width) * n_channels + r / height + x * n_channels] =
+                        src[x * n_pairs + r / 2];
+                }
+        }
+    }
+
+  private:
+    // row pairs transposed together, so that the rows they are read from
+    // or written to stay in the cache
+    static const size_t k_block = 16;
+
+    struct Scratch {
+        std::vector<float> re, im, tmp_re, tmp_im;
+        std::vector<size_t> offset; // of each row in the column layout
+    };
+
+    // per-thread buffers of at least size numbers and n_rows row offsets,
+    // they only grow
+    static Scratch &scratch(size_t size, size_t n_rows)
+    {
+        static thread_local Scratch buf;
+        if (buf.re.size() < size) {
+            buf.re.resize(size);
+            buf.im.resize(size);
+            buf.tmp_re.resize(size);
+            buf.tmp_im.resize(size);
+        }
+        if (buf.offset.size() < n_rows)
+            buf.offset.resize(n_rows);
+        return buf;
+    }
+
+    unsigned width, height;
+    Plan1d rows, cols; // transforms along the rows (length width) and columns
+};
+
+} // namespace builtin_fft
+
+class FftBuiltin : public Fft
+{
+public:
+    const char *name() const override { return "builtin"; }
+    unsigned spectrum_width(unsigned width) const override { return width / 2 + 1; }
+
+    void init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales) override
+    {
+        (void)num_of_feats;
+        (void)num_of_scales;
+        std::cout << "FFT: built-in" << std::endl;
+        m_width = width;
+        m_height = height;
+        m_fft.reset(new builtin_fft::Real2d(width, height));
+    }
+
+    void forward(const cv::Mat & real_input, ComplexMat & complex_result, float *real_input_arr,
+                 cudaStream_t stream) override
+    {
+        forward_window(real_input, complex_result, real_input_arr, stream);
+    }
+
+    // The channels (or scales) stacked in patch_feats are transformed together
+    void forward_window(const cv::Mat & patch_feats, ComplexMat & complex_result, float *real_input_arr,
+                        cudaStream_t stream) override
+    {
+        (void)real_input_arr;
+        (void)stream;
+        unsigned n_channels = unsigned(patch_feats.rows) / m_height;
+        assert(patch_feats.type() == CV_32F && complex_result.rows == m_height &&
+               complex_result.cols == m_fft->spectrum_width() && complex_result.n_channels >= n_channels);
+        m_fft->forward(patch_feats.ptr<float>(), patch_feats.step1(), n_channels, complex_result.get_p_data());
+    }
+
+    void inverse(ComplexMat & complex_input, cv::Mat & real_result, float *real_result_arr,
+                 cudaStream_t stream) override
+    {
+        (void)real_result_arr;
+        (void)stream;
+        unsigned n_channels = complex_input.n_channels;
+        assert(complex_input.rows == m_height && complex_input.cols == m_fft->spectrum_width());
+        // like Fftw, the result is written to the memory of real_result
+        assert(real_result.isContinuous() && real_result.depth() == CV_32F &&
+               real_result.total() * real_result.channels() >= size_t(m_width) * m_height * n_channels);
+        m_fft->inverse(complex_input.get_p_data(), n_channels, real_result.ptr<float>());
+    }
+
+    ~FftBuiltin() override {}
+
+private:
+    unsigned m_width = 0, m_height = 0;
+    std::unique_ptr<builtin_fft::Real2d> m_fft;
+};
+
+#endif // FFT_BUILTIN_HPP
@@ -107,11 +107,6 @@ void cuFFT::init(unsigned width, unsigned height, unsigned num_of_feats, unsigne
 #endif
 }
 
-void cuFFT::set_window(const cv::Mat &window)
-{
-    m_window = window;
-}
-
 void cuFFT::forward(const cv::Mat &real_input, ComplexMat &complex_result, float *real_input_arr, cudaStream_t stream)
 {
     if (BIG_BATCH_MODE && real_input.rows == int(m_height * m_num_of_scales)) {
@@ -129,23 +124,15 @@ void cuFFT::forward(const cv::Mat &real_input, ComplexMat &complex_result, float
     return;
 }
 
-void cuFFT::forward_window(std::vector<cv::Mat> patch_feats, ComplexMat &complex_result, cv::Mat &fw_all,
-                           float *real_input_arr, cudaStream_t stream)
+void cuFFT::forward_window(const cv::Mat &patch_feats, ComplexMat &complex_result, float *real_input_arr,
+                           cudaStream_t stream)
 {
-    int n_channels = int(patch_feats.size());
+    int n_channels = patch_feats.rows / int(m_height);
 
     if (n_channels > int(m_num_of_feats)) {
-        for (uint i = 0; i < uint(n_channels); ++i) {
-            cv::Mat in_roi(fw_all, cv::Rect(0, int(i * m_height), int(m_width), int(m_height)));
-            in_roi = patch_feats[i].mul(m_window);
-        }
         CufftErrorCheck(cufftExecR2C(plan_fw_all_scales, reinterpret_cast<cufftReal *>(real_input_arr),
                                      complex_result.get_p_data()));
     } else {
-        for (uint i = 0; i < uint(n_channels); ++i) {
-            cv::Mat in_roi(fw_all, cv::Rect(0, int(i * m_height), int(m_width), int(m_height)));
-            in_roi = patch_feats[i].mul(m_window);
-        }
         NORMAL_OMP_CRITICAL
         {
             CufftErrorCheck(cufftSetStream(plan_fw, stream));
@@ -169,13 +156,10 @@ void cuFFT::inverse(ComplexMat &complex_input, cv::Mat &real_result, float *real
             CufftErrorCheck(cufftExecC2R(plan_i_1ch, in, reinterpret_cast<cufftReal *>(real_result_arr)));
             cudaStreamSynchronize(stream);
         }
-        real_result = real_result / (m_width * m_height);
         return;
     } else if (n_channels == int(m_num_of_scales)) {
         CufftErrorCheck(cufftExecC2R(plan_i_1ch_all_scales, in, reinterpret_cast<cufftReal *>(real_result_arr)));
         cudaStreamSynchronize(stream);
-
-        real_result = real_result / (m_width * m_height);
         return;
     } else if (n_channels == int(m_num_of_feats) * int(m_num_of_scales)) {
         CufftErrorCheck(cufftExecC2R(plan_i_features_all_scales, in, reinterpret_cast<cufftReal *>(real_result_arr)));
@@ -2,6 +2,12 @@
 
 #include "fft.h"
 
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <mutex>
+#include <tuple>
+
 #ifdef OPENMP
 #include <omp.h>
 #endif
@@ -12,164 +18,191 @@
 #define FFTW_PLAN_WITH_THREADS()
 #endif
 
-Fftw::Fftw(){}
+// Plans shared by all Fftw objects of the process, they are created on
+// first use and live until the process exits. The FFTW planner is not
+// thread-safe, so everything that plans or touches the wisdom holds
+// plan_mutex. Executing the plans on new arrays is thread-safe, as long as
+// the arrays are aligned like the ones they were created on.
+namespace {
 
-void Fftw::init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales)
-{
-    m_width = width;
-    m_height = height;
-    m_num_of_feats = num_of_feats;
-    m_num_of_scales = num_of_scales;
+enum PlanKind { R2C, C2R };
 
-#if (!defined(ASYNC) && !defined(CUFFTW)) && defined(OPENMP)
-    fftw_init_threads();
-#endif // OPENMP
+struct PlanKey {
+    PlanKind kind;
+    int height, width, howmany;
+    bool operator<(const PlanKey &o) const
+    {
+        if (kind != o.kind) return kind < o.kind;
+        if (height != o.height) return height < o.height;
+        if (width != o.width) return width < o.width;
+        return howmany < o.howmany;
+    }
+};
 
-#ifndef CUFFTW
-    std::cout << "FFT: FFTW" << std::endl;
-#else
-    std::cout << "FFT: cuFFTW" << std::endl;
-#endif
-    fftwf_cleanup();
-    // FFT forward one scale
+struct PlanCache {
+    std::map<PlanKey, fftwf_plan> plans;
+    ~PlanCache()
     {
-        cv::Mat in_f = cv::Mat::zeros(int(m_height), int(m_width), CV_32FC1);
-        ComplexMat out_f(int(m_height), m_width / 2 + 1, 1);
-        plan_f = fftwf_plan_dft_r2c_2d(int(m_height), int(m_width), reinterpret_cast<float *>(in_f.data),
-                                       reinterpret_cast<fftwf_complex *>(out_f.get_p_data()), FFTW_PATIENT);
+        for (auto &it : plans)
+            fftwf_destroy_plan(it.second);
     }
-#ifdef BIG_BATCH
-    // FFT forward all scales
-    if (m_num_of_scales > 1 && BIG_BATCH_MODE) {
-        cv::Mat in_f_all = cv::Mat::zeros(m_height * m_num_of_scales, m_width, CV_32F);
-        ComplexMat out_f_all(m_height, m_width / 2 + 1, m_num_of_scales);
-        float *in = reinterpret_cast<float *>(in_f_all.data);
-        fftwf_complex *out = reinterpret_cast<fftwf_complex *>(out_f_all.get_p_data());
-        int rank = 2;
-        int n[] = {(int)m_height, (int)m_width};
-        int howmany = m_num_of_scales;
-        int idist = m_height * m_width, odist = m_height * (m_width / 2 + 1);
-        int istride = 1, ostride = 1;
-        int *inembed = NULL, *onembed = NULL;
+};
+
+std::mutex plan_mutex;
+PlanCache plan_cache;
 
-        FFTW_PLAN_WITH_THREADS();
-        plan_f_all_scales = fftwf_plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed,
-                                                    ostride, odist, FFTW_PATIENT);
+// Plan of howmany 2D transforms of height x width. R2C transforms read the
+// real inputs one after another and write the spectra one after another.
+// C2R transforms read such spectra and write the results interleaved, as
+// the channels of a cv::Mat.
+fftwf_plan get_plan(PlanKind kind, unsigned height, unsigned width, unsigned howmany)
+{
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    PlanKey key{kind, int(height), int(width), int(howmany)};
+    auto it = plan_cache.plans.find(key);
+    if (it != plan_cache.plans.end())
+        return it->second;
+
+#if (!defined(ASYNC) && !defined(CUFFTW)) && defined(OPENMP)
+    static bool threads_initialized = false;
+    if (!threads_initialized) {
+        fftw_init_threads();
+        threads_initialized = true;
     }
-#endif
-    // FFT forward window one scale
-    {
-        cv::Mat in_fw = cv::Mat::zeros(int(m_height * m_num_of_feats), int(m_width), CV_32F);
-        ComplexMat out_fw(int(m_height), m_width / 2 + 1, int(m_num_of_feats));
-        float *in = reinterpret_cast<float *>(in_fw.data);
-        fftwf_complex *out = reinterpret_cast<fftwf_complex *>(out_fw.get_p_data());
-        int rank = 2;
-        int n[] = {int(m_height), int(m_width)};
-        int howmany = int(m_num_of_feats);
-        int idist = int(m_height * m_width), odist = int(m_height * (m_width / 2 + 1));
+#endif // OPENMP
+
+    int rank = 2;
+    int n[] = {int(height), int(width)};
+    int real_size = int(height * width), complex_size = int(height * (width / 2 + 1));
+    // The arrays are DYNMEM_ALIGNMENT aligned like the ones the plans are
+    // executed on, which Fftw::is_aligned() checks
+    DynMem real_mem(size_t(real_size) * howmany * sizeof(float));
+    ComplexMat complex_mat(height, width / 2 + 1, howmany);
+    float *real = real_mem.hostMem();
+    std::fill_n(real, size_t(real_size) * howmany, 0.f);
+    fftwf_complex *complex = reinterpret_cast<fftwf_complex *>(complex_mat.get_p_data());
+
+    fftwf_plan plan;
+    FFTW_PLAN_WITH_THREADS();
+    if (kind == R2C) {
         int istride = 1, ostride = 1;
         int *inembed = nullptr, *onembed = nullptr;
-
-        FFTW_PLAN_WITH_THREADS();
-        plan_fw = fftwf_plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist,
-                                          FFTW_PATIENT);
+        plan = fftwf_plan_many_dft_r2c(rank, n, int(howmany), real, inembed, istride, real_size, complex, onembed,
+                                       ostride, complex_size, FFTW_PATIENT);
+    } else {
+        int istride = 1, ostride = int(howmany);
+        int inembed[] = {int(height), int(width / 2 + 1)}, *onembed = n;
+        plan = fftwf_plan_many_dft_c2r(rank, n, int(howmany), complex, inembed, istride, complex_size, real, onembed,
+                                       ostride, 1, FFTW_PATIENT);
     }
-#ifdef BIG_BATCH
-    // FFT forward window all scales all feats
-    if (m_num_of_scales > 1 && BIG_BATCH_MODE) {
-        cv::Mat in_all = cv::Mat::zeros(m_height * (m_num_of_scales * m_num_of_feats), m_width, CV_32F);
-        ComplexMat out_all(m_height, m_width / 2 + 1, m_num_of_scales * m_num_of_feats);
-        float *in = reinterpret_cast<float *>(in_all.data);
-        fftwf_complex *out = reinterpret_cast<fftwf_complex *>(out_all.get_p_data());
-        int rank = 2;
-        int n[] = {(int)m_height, (int)m_width};
-        int howmany = m_num_of_scales * m_num_of_feats;
-        int idist = m_height * m_width, odist = m_height * (m_width / 2 + 1);
-        int istride = 1, ostride = 1;
-        int *inembed = NULL, *onembed = NULL;
 
-        FFTW_PLAN_WITH_THREADS();
-        plan_fw_all_scales = fftwf_plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed,
-                                                     ostride, odist, FFTW_PATIENT);
+    plan_cache.plans[key] = plan;
+    return plan;
+}
+
+struct PlansKey {
+    unsigned width, height, num_of_feats, num_of_scales, batch_windows;
+    bool operator<(const PlansKey &o) const
+    {
+        return std::tie(width, height, num_of_feats, num_of_scales, batch_windows) <
+               std::tie(o.width, o.height, o.num_of_feats, o.num_of_scales, o.batch_windows);
     }
-#endif
-    // FFT inverse one scale
+};
+
+std::mutex plans_mutex;
+std::map<PlansKey, std::shared_ptr<const Fftw::Plans>> plan_sets;
+
+} // namespace
+
+std::shared_ptr<const Fftw::Plans> Fftw::plans(unsigned width, unsigned height, unsigned num_of_feats,
+                                               unsigned num_of_scales, unsigned batch_windows)
+{
+    PlansKey key{width, height, num_of_feats, num_of_scales, batch_windows};
     {
-        ComplexMat in_i(m_height, m_width, m_num_of_feats);
-        cv::Mat out_i = cv::Mat::zeros(int(m_height), int(m_width), CV_32FC(int(m_num_of_feats)));
-        fftwf_complex *in = reinterpret_cast<fftwf_complex *>(in_i.get_p_data());
-        float *out = reinterpret_cast<float *>(out_i.data);
-        int rank = 2;
-        int n[] = {int(m_height), int(m_width)};
-        int howmany = int(m_num_of_feats);
-        int idist = int(m_height * (m_width / 2 + 1)), odist = 1;
-        int istride = 1, ostride = int(m_num_of_feats);
-        int inembed[] = {int(m_height), int(m_width / 2 + 1)}, *onembed = n;
-
-        FFTW_PLAN_WITH_THREADS();
-        plan_i_features = fftwf_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride,
-                                                  odist, FFTW_PATIENT);
+        std::lock_guard<std::mutex> lock(plans_mutex);
+        auto it = plan_sets.find(key);
+        if (it != plan_sets.end())
+            return it->second;
     }
-    // FFT inverse all scales
+
+    // Planning takes long, so it runs without plans_mutex. If another
+    // thread creates the same set meanwhile, its set is used and this one
+    // is dropped; both consist of the same cached plans.
+    std::shared_ptr<Plans> p = std::make_shared<Plans>(Plans{width, height, num_of_feats, num_of_scales,
+                                                             batch_windows, nullptr, nullptr, nullptr, nullptr,
+                                                             nullptr, nullptr, nullptr, nullptr, nullptr});
+    // FFT forward one scale
+    p->f = get_plan(R2C, height, width, 1);
+    // FFT forward window one scale
+    p->fw = get_plan(R2C, height, width, num_of_feats);
+    // FFT inverse one scale
+    p->i_features = get_plan(C2R, height, width, num_of_feats);
+    // FFT inverse one channel one scale
+    p->i_1ch = get_plan(C2R, height, width, 1);
 #ifdef BIG_BATCH
-    if (m_num_of_scales > 1 && BIG_BATCH_MODE) {
-        ComplexMat in_i_all(m_height, m_width, m_num_of_feats * m_num_of_scales);
-        cv::Mat out_i_all = cv::Mat::zeros(m_height, m_width, CV_32FC(m_num_of_feats * m_num_of_scales));
-        fftwf_complex *in = reinterpret_cast<fftwf_complex *>(in_i_all.get_p_data());
-        float *out = reinterpret_cast<float *>(out_i_all.data);
-        int rank = 2;
-        int n[] = {(int)m_height, (int)m_width};
-        int howmany = m_num_of_feats * m_num_of_scales;
-        int idist = m_height * (m_width / 2 + 1), odist = 1;
-        int istride = 1, ostride = m_num_of_feats * m_num_of_scales;
-        int inembed[] = {(int)m_height, (int)m_width / 2 + 1}, *onembed = n;
-
-        FFTW_PLAN_WITH_THREADS();
-        plan_i_features_all_scales = fftwf_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out,
-                                                             onembed, ostride, odist, FFTW_PATIENT);
+    if (num_of_scales > 1 && BIG_BATCH_MODE) {
+        // FFT forward all scales
+        p->f_all_scales = get_plan(R2C, height, width, num_of_scales);
+        // FFT forward window all scales all feats
+        p->fw_all_scales = get_plan(R2C, height, width, num_of_scales * num_of_feats);
+        // FFT inverse all scales
+        p->i_features_all_scales = get_plan(C2R, height, width, num_of_feats * num_of_scales);
+        // FFT inverse one channel all scales
+        p->i_1ch_all_scales = get_plan(C2R, height, width, num_of_scales);
     }
 #endif
-    // FFT inver one channel one scale
-    {
-        ComplexMat in_i1(int(m_height), int(m_width), 1);
-        cv::Mat out_i1 = cv::Mat::zeros(int(m_height), int(m_width), CV_32FC1);
-        fftwf_complex *in = reinterpret_cast<fftwf_complex *>(in_i1.get_p_data());
-        float *out = reinterpret_cast<float *>(out_i1.data);
-        int rank = 2;
-        int n[] = {int(m_height), int(m_width)};
-        int howmany = 1;
-        int idist = int(m_height * (m_width / 2 + 1)), odist = 1;
-        int istride = 1, ostride = 1;
-        int inembed[] = {int(m_height), int(m_width) / 2 + 1}, *onembed = n;
+    // FFT forward window of batch_windows windows stored one after another
+    if (batch_windows > 1)
+        p->fw_batch = get_plan(R2C, height, width, num_of_feats * batch_windows);
 
-        FFTW_PLAN_WITH_THREADS();
-        plan_i_1ch = fftwf_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride,
-                                             odist, FFTW_PATIENT);
-    }
-#ifdef BIG_BATCH
-    // FFT inver one channel all scales
-    if (m_num_of_scales > 1 && BIG_BATCH_MODE) {
-        ComplexMat in_i1_all(m_height, m_width, m_num_of_scales);
-        cv::Mat out_i1_all = cv::Mat::zeros(m_height, m_width, CV_32FC(m_num_of_scales));
-        fftwf_complex *in = reinterpret_cast<fftwf_complex *>(in_i1_all.get_p_data());
-        float *out = reinterpret_cast<float *>(out_i1_all.data);
-        int rank = 2;
-        int n[] = {(int)m_height, (int)m_width};
-        int howmany = m_num_of_scales;
-        int idist = m_height * (m_width / 2 + 1), odist = 1;
-        int istride = 1, ostride = m_num_of_scales;
-        int inembed[] = {(int)m_height, (int)m_width / 2 + 1}, *onembed = n;
-
-        FFTW_PLAN_WITH_THREADS();
-        plan_i_1ch_all_scales = fftwf_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out, onembed,
-                                                        ostride, odist, FFTW_PATIENT);
-    }
+    std::lock_guard<std::mutex> lock(plans_mutex);
+    return plan_sets.emplace(key, p).first->second;
+}
+
+Fftw::Fftw(){}
+
+bool Fftw::load_wisdom(const std::string &file)
+{
+#ifndef CUFFTW
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    return fftwf_import_wisdom_from_filename(file.c_str()) != 0;
+#else
+    (void)file;
+    return true;
 #endif
 }
 
-void Fftw::set_window(const cv::Mat &window)
+bool Fftw::save_wisdom(const std::string &file)
 {
-    m_window = window;
+#ifndef CUFFTW
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    return fftwf_export_wisdom_to_filename(file.c_str()) != 0;
+#else
+    (void)file;
+    return true;
+#endif
+}
+
+void Fftw::init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales)
+{
+#ifndef CUFFTW
+    std::cout << "FFT: FFTW" << std::endl;
+#else
+    std::cout << "FFT: cuFFTW" << std::endl;
+#endif
+    m_plans = plans(width, height, num_of_feats, num_of_scales);
+}
+
+bool Fftw::is_aligned(const void *data) const
+{
+#ifndef CUFFTW
+    // the plans were created on arrays with this alignment, see get_plan()
+    return fftwf_alignment_of(static_cast<float *>(const_cast<void *>(data))) == 0;
+#else
+    // cuFFTW copies the arrays to the device
+    (void)data;
+    return true;
+#endif
 }
 
 void Fftw::forward(const cv::Mat &real_input, ComplexMat &complex_result, float *real_input_arr, cudaStream_t stream)
@@ -177,35 +210,34 @@ void Fftw::forward(const cv::Mat &real_input, ComplexMat &complex_result, float
     (void)real_input_arr;
     (void)stream;
 
-    if (BIG_BATCH_MODE && real_input.rows == int(m_height * m_num_of_scales)) {
-        fftwf_execute_dft_r2c(plan_f_all_scales, reinterpret_cast<float *>(real_input.data),
+    const Plans &p = *m_plans;
+    assert(is_aligned(real_input.data) && is_aligned(complex_result.get_p_data()));
+    if (BIG_BATCH_MODE && real_input.rows == int(p.height * p.num_of_scales)) {
+        fftwf_execute_dft_r2c(p.f_all_scales, reinterpret_cast<float *>(real_input.data),
                               reinterpret_cast<fftwf_complex *>(complex_result.get_p_data()));
     } else {
-        fftwf_execute_dft_r2c(plan_f, reinterpret_cast<float *>(real_input.data),
+        fftwf_execute_dft_r2c(p.f, reinterpret_cast<float *>(real_input.data),
                               reinterpret_cast<fftwf_complex *>(complex_result.get_p_data()));
     }
     return;
 }
 
-void Fftw::forward_window(std::vector<cv::Mat> patch_feats, ComplexMat &complex_result, cv::Mat &fw_all,
-                          float *real_input_arr, cudaStream_t stream)
+void Fftw::forward_window(const cv::Mat &patch_feats, ComplexMat &complex_result, float *real_input_arr,
+                          cudaStream_t stream)
 {
     (void)real_input_arr;
     (void)stream;
 
-    int n_channels = int(patch_feats.size());
-    for (int i = 0; i < n_channels; ++i) {
-        cv::Mat in_roi(fw_all, cv::Rect(0, i * int(m_height), int(m_width), int(m_height)));
-        in_roi = patch_feats[uint(i)].mul(m_window);
-    }
-
-    float *in = reinterpret_cast<float *>(fw_all.data);
+    const Plans &p = *m_plans;
+    int n_channels = patch_feats.rows / int(p.height);
+    float *in = reinterpret_cast<float *>(patch_feats.data);
     fftwf_complex *out = reinterpret_cast<fftwf_complex *>(complex_result.get_p_data());
+    assert(is_aligned(in) && is_aligned(out));
 
-    if (n_channels <= int(m_num_of_feats))
-        fftwf_execute_dft_r2c(plan_fw, in, out);
+    if (n_channels <= int(p.num_of_feats))
+        fftwf_execute_dft_r2c(p.fw, in, out);
     else
-        fftwf_execute_dft_r2c(plan_fw_all_scales, in, out);
+        fftwf_execute_dft_r2c(p.fw_all_scales, in, out);
     return;
 }
 
@@ -214,34 +246,74 @@ void Fftw::inverse(ComplexMat &complex_input, cv::Mat &real_result, float *real_
     (void)real_result_arr;
     (void)stream;
 
+    const Plans &p = *m_plans;
     int n_channels = complex_input.n_channels;
     fftwf_complex *in = reinterpret_cast<fftwf_complex *>(complex_input.get_p_data());
     float *out = reinterpret_cast<float *>(real_result.data);
+    assert(is_aligned(in) && is_aligned(out));
 
     if (n_channels == 1)
-        fftwf_execute_dft_c2r(plan_i_1ch, in, out);
-    else if (BIG_BATCH_MODE && n_channels == int(m_num_of_scales))
-        fftwf_execute_dft_c2r(plan_i_1ch_all_scales, in, out);
-    else if (BIG_BATCH_MODE && n_channels == int(m_num_of_feats) * int(m_num_of_scales))
-        fftwf_execute_dft_c2r(plan_i_features_all_scales, in, out);
+        fftwf_execute_dft_c2r(p.i_1ch, in, out);
+    else if (BIG_BATCH_MODE && n_channels == int(p.num_of_scales))
+        fftwf_execute_dft_c2r(p.i_1ch_all_scales, in, out);
+    else if (BIG_BATCH_MODE && n_channels == int(p.num_of_feats) * int(p.num_of_scales))
+        fftwf_execute_dft_c2r(p.i_features_all_scales, in, out);
     else
-        fftwf_execute_dft_c2r(plan_i_features, in, out);
-
-    real_result = real_result / (m_width * m_height);
+        fftwf_execute_dft_c2r(p.i_features, in, out);
     return;
 }
 
-Fftw::~Fftw()
+void Fftw::init_batch(unsigned n_windows)
 {
-    fftwf_destroy_plan(plan_f);
-    fftwf_destroy_plan(plan_fw);
-    fftwf_destroy_plan(plan_i_features);
-    fftwf_destroy_plan(plan_i_1ch);
-
-    if (BIG_BATCH_MODE) {
-        fftwf_destroy_plan(plan_f_all_scales);
-        fftwf_destroy_plan(plan_i_features_all_scales);
-        fftwf_destroy_plan(plan_fw_all_scales);
-        fftwf_destroy_plan(plan_i_1ch_all_scales);
+    const Plans &p = *m_plans;
+    m_plans = plans(p.width, p.height, p.num_of_feats, p.num_of_scales, n_windows);
+}
+
+// The windows of the jobs are in different buffers, so groups of
+// batch_windows of them are gathered into scratch memory of the calling
+// thread, transformed by one execution and scattered to the results. The
+// remaining jobs are transformed one by one.
+void Fftw::forward_window_batch(const WindowJob *jobs, size_t n_jobs)
+{
+    const Plans &p = *m_plans;
+    const size_t in_size = size_t(p.height) * p.width * p.num_of_feats;
+    const size_t out_size = size_t(p.height) * (p.width / 2 + 1) * p.num_of_feats;
+    size_t i = 0;
+
+    if (p.fw_batch && n_jobs >= p.batch_windows) {
+        // aligned like the arrays the plan was created on
+        thread_local DynMem in_batch, out_batch;
+        thread_local size_t in_capacity = 0, out_capacity = 0;
+        if (in_capacity < in_size * p.batch_windows) {
+            in_capacity = in_size * p.batch_windows;
+            in_batch = DynMem(in_capacity * sizeof(float));
+        }
+        if (out_capacity < out_size * p.batch_windows) {
+            out_capacity = out_size * p.batch_windows;
+            out_batch = DynMem(out_capacity * sizeof(std::complex<float>));
+        }
+        float *in = in_batch.hostMem();
+        std::complex<float> *out = reinterpret_cast<std::complex<float> *>(out_batch.hostMem());
+
+        for (; i + p.batch_windows <= n_jobs; i += p.batch_windows) {
+            for (unsigned k = 0; k < p.batch_windows; ++k) {
+                const cv::Mat &feats = *jobs[i + k].patch_feats;
+                assert(feats.isContinuous() && feats.total() == in_size);
+                std::copy_n(feats.ptr<float>(), in_size, in + k * in_size);
+            }
+            fftwf_execute_dft_r2c(p.fw_batch, in, reinterpret_cast<fftwf_complex *>(out));
+            for (unsigned k = 0; k < p.batch_windows; ++k) {
+                ComplexMat &result = *jobs[i + k].result;
+                assert(size_t(result.n_channels) * result.rows * result.cols == out_size);
+                std::copy_n(out + k * out_size, out_size, result.get_p_data());
+            }
+        }
     }
+    for (; i < n_jobs; ++i)
+        forward_window(*jobs[i].patch_feats, *jobs[i].result, jobs[i].real_input_arr, jobs[i].stream);
+}
+
+Fftw::~Fftw()
+{
+    // the plans belong to the process-wide plan sets
 }
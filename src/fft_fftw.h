@@ -4,9 +4,8 @@
 
 #include "fft.h"
 
-#if defined(ASYNC)
-#include <mutex>
-#endif
+#include <memory>
+#include <string>
 
 #ifndef CUFFTW
   #include <fftw3.h>
@@ -17,18 +16,45 @@
 class Fftw : public Fft
 {
 public:
+    // The plans for one window size. A set is created once for each size
+    // and shared by all Fftw objects of that size. It is never modified
+    // afterwards, so any number of threads can execute its plans at the
+    // same time, each on its own (new) arrays. The plans of one kind that
+    // are not needed are nullptr.
+    struct Plans {
+        unsigned width, height, num_of_feats, num_of_scales, batch_windows;
+        fftwf_plan f, f_all_scales, fw, fw_all_scales, i_features, i_features_all_scales, i_1ch,
+            i_1ch_all_scales, fw_batch;
+    };
+    // The shared plan set of the size, created on first use. batch_windows
+    // is the number of windows forward_window_batch() transforms at once.
+    static std::shared_ptr<const Plans> plans(unsigned width, unsigned height, unsigned num_of_feats,
+                                              unsigned num_of_scales, unsigned batch_windows = 0);
+
     Fftw();
+    // Planner state shared by all processes using the same file, a warm
+    // start with the wisdom of an earlier run plans quickly
+    static bool load_wisdom(const std::string & file);
+    static bool save_wisdom(const std::string & file);
+#ifndef CUFFTW
+    const char *name() const override { return "fftw"; }
+#else
+    const char *name() const override { return "cufftw"; }
+#endif
+    unsigned spectrum_width(unsigned width) const override { return width / 2 + 1; }
     void init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales) override;
-    void set_window(const cv::Mat & window) override;
     void forward(const cv::Mat & real_input, ComplexMat & complex_result, float *real_input_arr, cudaStream_t  stream) override;
-    void forward_window(std::vector<cv::Mat> patch_feats, ComplexMat & complex_result, cv::Mat & fw_all, float *real_input_arr, cudaStream_t stream) override;
+    void forward_window(const cv::Mat & patch_feats, ComplexMat & complex_result, float *real_input_arr, cudaStream_t stream) override;
     void inverse(ComplexMat &  complex_input, cv::Mat & real_result, float *real_result_arr, cudaStream_t stream) override;
+    void init_batch(unsigned n_windows) override;
+    void forward_window_batch(const WindowJob *jobs, size_t n_jobs) override;
     ~Fftw() override;
+
+protected:
+    bool is_aligned(const void *data) const override;
+
 private:
-    unsigned m_width, m_height, m_num_of_feats, m_num_of_scales;
-    cv::Mat m_window;
-    fftwf_plan plan_f, plan_f_all_scales, plan_fw, plan_fw_all_scales, plan_i_features,
-	plan_i_features_all_scales, plan_i_1ch, plan_i_1ch_all_scales;
+    std::shared_ptr<const Plans> m_plans;
 };
 
 #endif // FFT_FFTW_H
@@ -1,43 +1,107 @@
 #include "fft_opencv.h"
 
+// cv::dft() stores the spectrum of a real rows x width image in the packed
+// CCS format: columns 1 .. (width - 1) / 2 of the spectrum as (re, im)
+// pairs in the image columns 2k - 1 and 2k, and the columns 0 and, for an
+// even width, width / 2, which are spectra of real columns, packed the
+// same way along the image columns 0 and width - 1. The spectra here hold
+// the columns 0 .. width / 2, like the FFTW ones.
+
+static void unpack_ccs_column(const cv::Mat &ccs, int src_col, std::complex<float> *out, int cols, int dst_col)
+{
+    int rows = ccs.rows;
+    out[dst_col] = ccs.ptr<float>(0)[src_col];
+    for (int j = 1; j < (rows + 1) / 2; ++j) {
+        std::complex<float> v(ccs.ptr<float>(2 * j - 1)[src_col], ccs.ptr<float>(2 * j)[src_col]);
+        out[j * cols + dst_col] = v;
+        out[(rows - j) * cols + dst_col] = std::conj(v);
+    }
+    if (rows % 2 == 0)
+        out[rows / 2 * cols + dst_col] = ccs.ptr<float>(rows - 1)[src_col];
+}
+
+// Copies the CCS spectrum to channel ch of result
+static void unpack_ccs(const cv::Mat &ccs, ComplexMat &result, uint ch)
+{
+    int width = ccs.cols, cols = int(result.cols);
+    std::complex<float> *out = result.get_p_data() + size_t(ch) * result.rows * result.cols;
+    for (int y = 0; y < ccs.rows; ++y) {
+        const float *in = ccs.ptr<float>(y);
+        std::complex<float> *row = out + y * cols;
+        for (int k = 1; k < (width + 1) / 2; ++k)
+            row[k] = std::complex<float>(in[2 * k - 1], in[2 * k]);
+    }
+    unpack_ccs_column(ccs, 0, out, cols, 0);
+    if (width % 2 == 0)
+        unpack_ccs_column(ccs, width - 1, out, cols, width / 2);
+}
+
+static void pack_ccs_column(const std::complex<float> *in, int cols, int src_col, cv::Mat &ccs, int dst_col)
+{
+    int rows = ccs.rows;
+    ccs.ptr<float>(0)[dst_col] = in[src_col].real();
+    for (int j = 1; j < (rows + 1) / 2; ++j) {
+        ccs.ptr<float>(2 * j - 1)[dst_col] = in[j * cols + src_col].real();
+        ccs.ptr<float>(2 * j)[dst_col] = in[j * cols + src_col].imag();
+    }
+    if (rows % 2 == 0)
+        ccs.ptr<float>(rows - 1)[dst_col] = in[rows / 2 * cols + src_col].real();
+}
+
+// Packs channel ch of spectrum into ccs, width is the width of the real image
+static void pack_ccs(const ComplexMat &spectrum, uint ch, int width, cv::Mat &ccs)
+{
+    int cols = int(spectrum.cols);
+    const std::complex<float> *in = spectrum.get_p_data() + size_t(ch) * spectrum.rows * spectrum.cols;
+    ccs.create(int(spectrum.rows), width, CV_32F);
+    for (int y = 0; y < ccs.rows; ++y) {
+        float *out = ccs.ptr<float>(y);
+        const std::complex<float> *row = in + y * cols;
+        for (int k = 1; k < (width + 1) / 2; ++k) {
+            out[2 * k - 1] = row[k].real();
+            out[2 * k] = row[k].imag();
+        }
+    }
+    pack_ccs_column(in, cols, 0, ccs, 0);
+    if (width % 2 == 0)
+        pack_ccs_column(in, cols, width / 2, ccs, width - 1);
+}
+
 void FftOpencv::init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales)
 {
-    (void)width;
+    m_width = width;
     (void)height;
     (void)num_of_feats;
     (void)num_of_scales;
     std::cout << "FFT: OpenCV" << std::endl;
 }
 
-void FftOpencv::set_window(const cv::Mat &window)
-{
-    m_window = window;
-}
-
 void FftOpencv::forward(const cv::Mat &real_input, ComplexMat &complex_result, float *real_input_arr,
                         cudaStream_t stream)
 {
     (void)real_input_arr;
     (void)stream;
 
-    cv::Mat tmp;
-    cv::dft(real_input, tmp, cv::DFT_COMPLEX_OUTPUT);
-    complex_result = ComplexMat(tmp);
+    // per-thread buffers, reused between calls
+    static thread_local cv::Mat ccs;
+    cv::dft(real_input, ccs);
+    complex_result.create(uint(ccs.rows), spectrum_width(uint(ccs.cols)), 1, 1);
+    unpack_ccs(ccs, complex_result, 0);
     return;
 }
 
-void FftOpencv::forward_window(std::vector<cv::Mat> patch_feats, ComplexMat &complex_result, cv::Mat &fw_all,
-                               float *real_input_arr, cudaStream_t stream)
+void FftOpencv::forward_window(const cv::Mat &patch_feats, ComplexMat &complex_result, float *real_input_arr,
+                               cudaStream_t stream)
 {
     (void)real_input_arr;
-    (void)fw_all;
     (void)stream;
 
-    uint n_channels = uint(patch_feats.size());
-    for (uint i = 0; i < n_channels; ++i) {
-        cv::Mat complex_res;
-        cv::dft(patch_feats[i].mul(m_window), complex_res, cv::DFT_COMPLEX_OUTPUT);
-        complex_result.set_channel(int(i), complex_res);
+    static thread_local cv::Mat ccs;
+    int height = int(complex_result.rows);
+    int n_channels = patch_feats.rows / height;
+    for (int i = 0; i < n_channels; ++i) {
+        cv::dft(patch_feats.rowRange(i * height, (i + 1) * height), ccs);
+        unpack_ccs(ccs, complex_result, uint(i));
     }
     return;
 }
@@ -47,15 +111,17 @@ void FftOpencv::inverse(ComplexMat &complex_input, cv::Mat &real_result, float *
     (void)real_result_arr;
     (void)stream;
 
+    static thread_local cv::Mat ccs, ifft;
     if (complex_input.n_channels == 1) {
-        cv::dft(complex_input.to_cv_mat(), real_result, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+        pack_ccs(complex_input, 0, int(m_width), ccs);
+        cv::dft(ccs, real_result, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT);
     } else {
-        std::vector<cv::Mat> mat_channels = complex_input.to_cv_mat_vector();
-        std::vector<cv::Mat> ifft_mats(ulong(complex_input.n_channels));
+        real_result.create(int(complex_input.rows), int(m_width), CV_32FC(complex_input.n_channels));
         for (uint i = 0; i < uint(complex_input.n_channels); ++i) {
-            cv::dft(mat_channels[i], ifft_mats[i], cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+            pack_ccs(complex_input, i, int(m_width), ccs);
+            cv::dft(ccs, ifft, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT);
+            cv::insertChannel(ifft, real_result, int(i));
         }
-        cv::merge(ifft_mats, real_result);
     }
     return;
 }
@@ -7,14 +7,15 @@
 class FftOpencv : public Fft
 {
 public:
+    const char *name() const override { return "opencv"; }
+    unsigned spectrum_width(unsigned width) const override { return width / 2 + 1; }
     void init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales) override;
-    void set_window(const cv::Mat & window) override;
     void forward(const cv::Mat & real_input, ComplexMat & complex_result, float *real_input_arr, cudaStream_t  stream) override;
-    void forward_window(std::vector<cv::Mat> patch_feats, ComplexMat & complex_result, cv::Mat & fw_all, float *real_input_arr, cudaStream_t stream) override;
+    void forward_window(const cv::Mat & patch_feats, ComplexMat & complex_result, float *real_input_arr, cudaStream_t stream) override;
     void inverse(ComplexMat &  complex_input, cv::Mat & real_result, float *real_result_arr, cudaStream_t stream) override;
     ~FftOpencv() override;
 private:
-    cv::Mat m_window;
+    unsigned m_width = 0;
 };
 
 #endif // FFTOPENCV_H
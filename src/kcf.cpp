@@ -1,19 +1,8 @@
 #include "kcf.h"
-#include <numeric>
+#include "simd_kernels.h"
 #include <thread>
 #include <algorithm>
 
-#ifdef FFTW
-#include "fft_fftw.h"
-#define FFT Fftw
-#elif defined(CUFFT)
-#include "fft_cufft.h"
-#define FFT cuFFT
-#else
-#include "fft_opencv.h"
-#define FFT FftOpencv
-#endif
-
 #ifdef OPENMP
 #include <omp.h>
 #endif // OPENMP
@@ -40,22 +29,62 @@ void clamp2(T& n, const T& lower, const T& upper)
     n = std::max(lower, std::min(n, upper));
 }
 
+// Returns a rows x cols header over buf, which is enlarged only when it is too small
+static cv::Mat buffer_mat(cv::Mat &buf, int rows, int cols, int type)
+{
+    size_t size = size_t(rows) * size_t(cols) * CV_ELEM_SIZE(type);
+    if (buf.empty() || buf.total() * buf.elemSize() < size)
+        buf.create(1, int(std::max(size, size_t(1))), CV_8U);
+    return cv::Mat(rows, cols, type, buf.data);
+}
+
+// Smallest number >= n without prime factors larger than 7
+static int fft_friendly_size(int n)
+{
+    for (;; ++n) {
+        int m = n;
+        for (int p : {2, 3, 5, 7})
+            while (m % p == 0)
+                m /= p;
+        if (m == 1)
+            return n;
+    }
+}
+
+// Sum of the prime factors of n, a mixed-radix FFT of length n takes
+// about n times that many operations
+static int prime_factor_sum(int n)
+{
+    int sum = 0;
+    for (int p = 2; p * p <= n; ++p)
+        for (; n % p == 0; n /= p)
+            sum += p;
+    return n > 1 ? sum + n : sum;
+}
+
+// Estimated operations of a 2D FFT of width x height
+static double fft_cost(int width, int height)
+{
+    return double(width) * height * (prime_factor_sum(width) + prime_factor_sum(height));
+}
+
 KCF_Tracker::KCF_Tracker(double padding, double kernel_sigma, double lambda, double interp_factor,
                          double output_sigma_factor, int cell_size)
-    : fft(*new FFT()), p_padding(padding), p_output_sigma_factor(output_sigma_factor), p_kernel_sigma(kernel_sigma),
+    : p_fft(Fft::create()), p_padding(padding), p_output_sigma_factor(output_sigma_factor), p_kernel_sigma(kernel_sigma),
       p_lambda(lambda), p_interp_factor(interp_factor), p_cell_size(cell_size)
 {
 }
 
-KCF_Tracker::KCF_Tracker() : fft(*new FFT()) {}
+KCF_Tracker::KCF_Tracker() : p_fft(Fft::create()) {}
 
-KCF_Tracker::~KCF_Tracker()
-{
-    delete &fft;
-}
+KCF_Tracker::~KCF_Tracker() {}
 
 void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int fit_size_y)
 {
+    p_resize_image = false;
+    p_fit_to_pw2 = false;
+    p_scale_factor_x = p_scale_factor_y = 1.;
+
     // check boundary, enforce min size
     double x1 = bbox.x, x2 = bbox.x + bbox.width, y1 = bbox.y, y2 = bbox.y + bbox.height;
     if (x1 < 0) x1 = 0.;
@@ -91,20 +120,11 @@ void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int f
     p_pose.cx = x1 + p_pose.w / 2.;
     p_pose.cy = y1 + p_pose.h / 2.;
 
-    cv::Mat input_gray, input_rgb = img.clone();
-    if (img.channels() == 3) {
-        cv::cvtColor(img, input_gray, CV_BGR2GRAY);
-        input_gray.convertTo(input_gray, CV_32FC1);
-    } else
-        img.convertTo(input_gray, CV_32FC1);
-
     // don't need too large image
     if (p_pose.w * p_pose.h > 100. * 100. && (fit_size_x == -1 || fit_size_y == -1)) {
         std::cout << "resizing image by factor of " << 1 / p_downscale_factor << std::endl;
         p_resize_image = true;
         p_pose.scale(p_downscale_factor);
-        cv::resize(input_gray, input_gray, cv::Size(0, 0), p_downscale_factor, p_downscale_factor, cv::INTER_AREA);
-        cv::resize(input_rgb, input_rgb, cv::Size(0, 0), p_downscale_factor, p_downscale_factor, cv::INTER_AREA);
     } else if (!(fit_size_x == -1 && fit_size_y == -1)) {
         if (fit_size_x % p_cell_size != 0 || fit_size_y % p_cell_size != 0) {
             std::cerr << "Error: Fit size is not multiple of HOG cell size (" << p_cell_size << ")" << std::endl;
@@ -117,15 +137,6 @@ void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int f
         p_fit_to_pw2 = true;
         p_pose.scale_x(p_scale_factor_x);
         p_pose.scale_y(p_scale_factor_y);
-        if (fabs(p_scale_factor_x - 1) > p_floating_error || fabs(p_scale_factor_y - 1) > p_floating_error) {
-            if (p_scale_factor_x < 1 && p_scale_factor_y < 1) {
-                cv::resize(input_gray, input_gray, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_AREA);
-                cv::resize(input_rgb, input_rgb, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_AREA);
-            } else {
-                cv::resize(input_gray, input_gray, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_LINEAR);
-                cv::resize(input_rgb, input_rgb, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_LINEAR);
-            }
-        }
     }
 
     // compute win size + fit to fhog cell size
@@ -134,6 +145,18 @@ void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int f
     p_roi.width = p_windows_size.width / p_cell_size;
     p_roi.height = p_windows_size.height / p_cell_size;
 
+    // Grow the window (i.e. the padding) so that the FFTs are fast, the
+    // fit size is kept as requested
+    if (m_use_fft_friendly_size && !p_fit_to_pw2) {
+        cv::Size roi(fft_friendly_size(p_roi.width), fft_friendly_size(p_roi.height));
+        if (m_debug)
+            std::cout << "FFT cost model: " << p_roi.width << "x" << p_roi.height << " "
+                      << fft_cost(p_roi.width, p_roi.height) << ", " << roi.width << "x" << roi.height << " "
+                      << fft_cost(roi.width, roi.height) << std::endl;
+        p_roi = roi;
+        p_windows_size = cv::Size(p_roi.width * p_cell_size, p_roi.height * p_cell_size);
+    }
+
     p_num_of_feats = 31;
     if (m_use_color) p_num_of_feats += 3;
     if (m_use_cnfeat) p_num_of_feats += 10;
@@ -145,42 +168,16 @@ void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int f
     else
         p_scales.push_back(1.);
 
-#ifdef CUFFT
-    if (p_roi.height * (p_roi.width / 2 + 1) > 1024) {
-        std::cerr << "Window after forward FFT is too big for CUDA kernels. Plese use -f to set "
-                     "the window dimensions so its size is less or equal to "
-                  << 1024 * p_cell_size * p_cell_size * 2 + 1
-                  << " pixels . Currently the size of the window is: " << p_windows_size.width << "x" << p_windows_size.height
-                  << " which is  " << p_windows_size.width * p_windows_size.height << " pixels. " << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
-
-    if (m_use_linearkernel) {
-        std::cerr << "cuFFT supports only Gaussian kernel." << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
-    CudaSafeCall(cudaSetDeviceFlags(cudaDeviceMapHost));
-    p_rot_labels_data = DynMem(p_roi.width * p_roi.height * sizeof(float));
-    p_rot_labels = cv::Mat(p_roi, CV_32FC1, p_rot_labels_data.hostMem());
-#else
-    p_xf.create(p_roi.height, p_roi.height / 2 + 1, p_num_of_feats);
-#endif
-
-#if defined(CUFFT) || defined(FFTW)
-    uint width = p_roi.width / 2 + 1;
-#else
-    uint width = p_roi.width;
-#endif
-    p_model_xf.create(p_roi.height, width, p_num_of_feats);
-    p_yf.create(p_roi.height, width, 1);
-    p_xf.create(p_roi.height, width, p_num_of_feats);
-
-    int max = BIG_BATCH_MODE ? 2 : p_num_scales;
-    for (int i = 0; i < max; ++i) {
-        if (BIG_BATCH_MODE && i == 1)
-            p_threadctxs.emplace_back(p_roi, p_num_of_feats * p_num_scales, 1, p_num_scales);
-        else
-            p_threadctxs.emplace_back(p_roi, p_num_of_feats, p_scales[i], 1);
+    // A re-init with the same geometry keeps the buffers, the thread
+    // contexts, the FFT plans and the cosine window and only trains a new
+    // model.
+    Geometry geometry{p_roi, img.size(), img.type(), uint(p_num_of_feats), uint(p_scales.size()), m_use_linearkernel,
+                      m_fft_implementation};
+    bool reuse = !p_threadctxs.empty() && geometry == p_geometry;
+    p_geometry = geometry;
+    if (!reuse) {
+        select_fft();
+        init_buffers();
     }
 
     p_current_scale = 1.;
@@ -197,21 +194,33 @@ void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int f
     std::cout << "init: FFT size " << p_roi.width << "x" << p_roi.height << std::endl;
     std::cout << "init: min max scales factors: " << p_min_max_scale[0] << " " << p_min_max_scale[1] << std::endl;
 
-    p_output_sigma = std::sqrt(p_pose.w * p_pose.h) * p_output_sigma_factor / p_cell_size;
-
-    fft.init(p_roi.width, p_roi.height, p_num_of_feats, p_num_scales);
-    fft.set_window(cosine_window_function(p_roi.width, p_roi.height));
-
-    // window weights, i.e. labels
-    fft.forward(
-        gaussian_shaped_labels(p_output_sigma, p_roi.width, p_roi.height), p_yf,
-        m_use_cuda ? p_rot_labels_data.deviceMem() : nullptr, p_threadctxs.front().stream);
-    DEBUG_PRINTM(p_yf);
+    double output_sigma = std::sqrt(p_pose.w * p_pose.h) * p_output_sigma_factor / p_cell_size;
+    if (!reuse || output_sigma != p_output_sigma) {
+        p_output_sigma = output_sigma;
+        // window weights, i.e. labels
+        cv::Mat labels = gaussian_shaped_labels(p_output_sigma, p_roi.width, p_roi.height);
+        // Fft::inverse() does not normalize, so the responses would be
+        // width * height times too large. The factor is folded into the
+        // labels, which only enter the numerator of alphaf.
+        double numel_inv = 1. / (p_roi.width * p_roi.height);
+#ifdef CUFFT
+        p_rot_labels *= numel_inv;
+#else
+        // transformed from a buffer checked by init_buffers()
+        cv::Mat in = p_threadctxs.front().in_all.rowRange(0, p_roi.height);
+        labels.convertTo(in, CV_32F, numel_inv);
+        labels = in;
+#endif
+        p_fft->forward(labels, p_yf, m_use_cuda ? p_rot_labels_data.deviceMem() : nullptr,
+                       p_threadctxs.front().stream);
+        DEBUG_PRINTM(p_yf);
+    }
 
     // obtain a sub-window for training initial model
-    std::vector<cv::Mat> patch_feats = get_features(input_rgb, input_gray, p_pose.cx, p_pose.cy,
-                                                    p_windows_size.width, p_windows_size.height);
-    fft.forward_window(patch_feats, p_model_xf, p_threadctxs.front().fw_all,
+    preprocess_frame(img, feature_window(1.), true);
+    get_features(p_frame, p_pose.cx, p_pose.cy, p_windows_size.width, p_windows_size.height, 1.,
+                 p_threadctxs.front().feature_buffers.front(), p_threadctxs.front().fw_all);
+    p_fft->forward_window(p_threadctxs.front().fw_all, p_model_xf,
                        m_use_cuda ? p_threadctxs.front().data_features.deviceMem() : nullptr,
                        p_threadctxs.front().stream);
     DEBUG_PRINTM(p_model_xf);
@@ -224,16 +233,15 @@ void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int f
 #endif
 
     if (m_use_linearkernel) {
-        ComplexMat xfconj = p_model_xf.conj();
-        p_model_alphaf_num = xfconj.mul(p_yf);
-        p_model_alphaf_den = (p_model_xf * xfconj);
+        p_model_alphaf_num = p_model_xf.conj().mul(p_yf);
+        p_model_alphaf_den = (p_model_xf * p_model_xf.conj());
     } else {
         // Kernel Ridge Regression, calculate alphas (in Fourier domain)
 #if  !defined(BIG_BATCH) && defined(CUFFT) && (defined(ASYNC) || defined(OPENMP))
-        gaussian_correlation(p_threadctxs.front(), p_threadctxs.front().model_xf, p_threadctxs.front().model_xf,
-                             p_kernel_sigma, true);
+        gaussian_correlation(*p_fft, p_threadctxs.front(), p_threadctxs.front().model_xf,
+                             p_threadctxs.front().model_xf, p_kernel_sigma, true);
 #else
-        gaussian_correlation(p_threadctxs.front(), p_model_xf, p_model_xf, p_kernel_sigma, true);
+        gaussian_correlation(*p_fft, p_threadctxs.front(), p_model_xf, p_model_xf, p_kernel_sigma, true);
 #endif
         DEBUG_PRINTM(p_threadctxs.front().kf);
         p_model_alphaf_num = p_yf * p_threadctxs.front().kf;
@@ -253,6 +261,140 @@ void KCF_Tracker::init(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int f
         it->model_alphaf.set_stream(it->stream);
     }
 #endif
+
+    // Reserve the frame and sub-window buffers for the largest scale
+    // reachable by p_current_scale and run the detection once, so that all
+    // the buffers used by track(), including the per-thread ones, are
+    // allocated here.
+    double max_scale = std::max(1., p_min_max_scale[1]) * p_scales.back();
+    cv::Size max_window(int(floor(p_windows_size.width * max_scale)) + 2,
+                        int(floor(p_windows_size.height * max_scale)) + 2);
+    int src_factor = p_resize_image ? 2 : 1;
+    buffer_mat(p_frame_gray_u8, max_window.height * src_factor, max_window.width * src_factor, CV_8UC1);
+    buffer_mat(p_frame_gray, max_window.height * src_factor, max_window.width * src_factor, CV_32FC1);
+    if (p_resize_image) {
+        buffer_mat(p_frame_gray_resized, max_window.height, max_window.width, CV_32FC1);
+        buffer_mat(p_frame_rgb_resized, max_window.height, max_window.width, img.type());
+    }
+    for (ThreadCtx &ctx : p_threadctxs) {
+        for (FeatureBuffers &buf : ctx.feature_buffers) {
+            buffer_mat(buf.gray_buf, max_window.height, max_window.width, CV_32FC1);
+            buffer_mat(buf.rgb_buf, max_window.height, max_window.width, img.type());
+        }
+    }
+    if (m_use_feature_pyramid)
+        buffer_mat(p_pyramid.buf.gray_buf, max_window.height, max_window.width, CV_32FC1);
+#ifdef ASYNC
+    if (!p_pool && m_use_multithreading)
+        p_pool = std::make_shared<ThreadPool>(unsigned(p_threadctxs.size()) - 1);
+#endif
+    if (!reuse) {
+        preprocess_frame(img, search_region());
+        track_scales();
+    }
+}
+
+// Creates the FFT implementation requested by m_fft_implementation
+void KCF_Tracker::select_fft()
+{
+    std::string name = m_fft_implementation;
+    if (name == "auto")
+        name = Fft::fastest(p_roi.width, p_roi.height, p_num_of_feats, p_num_scales);
+    if (name.empty())
+        name = Fft::implementations().front();
+    if (p_fft && name == p_fft->name())
+        return;
+    p_fft.reset(Fft::create(name));
+    if (!p_fft) {
+        std::cerr << "Error: Unknown FFT implementation " << name << ", available:";
+        for (const std::string &impl : Fft::implementations())
+            std::cerr << " " << impl;
+        std::cerr << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+// Allocates the buffers, thread contexts and FFT plans for p_roi
+void KCF_Tracker::init_buffers()
+{
+#ifdef CUFFT
+    if (p_roi.height * (p_roi.width / 2 + 1) > 1024) {
+        std::cerr << "Window after forward FFT is too big for CUDA kernels. Plese use -f to set "
+                     "the window dimensions so its size is less or equal to "
+                  << 1024 * p_cell_size * p_cell_size * 2 + 1
+                  << " pixels . Currently the size of the window is: " << p_windows_size.width << "x" << p_windows_size.height
+                  << " which is  " << p_windows_size.width * p_windows_size.height << " pixels. " << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (m_use_linearkernel) {
+        std::cerr << "cuFFT supports only Gaussian kernel." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    CudaSafeCall(cudaSetDeviceFlags(cudaDeviceMapHost));
+#endif
+
+    uint width = p_fft->spectrum_width(p_roi.width);
+
+    // All working buffers are carved from a single arena sized here
+    int max = BIG_BATCH_MODE ? 2 : p_num_scales;
+    size_t arena_size = 0;
+    for (int i = 0; i < max; ++i) {
+        if (BIG_BATCH_MODE && i == 1)
+            arena_size += ThreadCtx::arena_size(p_roi, p_num_of_feats * p_num_scales, p_num_scales, width);
+        else
+            arena_size += ThreadCtx::arena_size(p_roi, p_num_of_feats, 1, width);
+    }
+#ifdef CUFFT
+    arena_size += dynmem_align(p_roi.width * p_roi.height * sizeof(float));
+#else
+    // the linear kernel model is not summed over feature channels
+    uint model_channels = m_use_linearkernel ? p_num_of_feats : 1;
+    arena_size += 2 * ComplexMat::arena_size(p_roi.height, width, p_num_of_feats);
+    arena_size += ComplexMat::arena_size(p_roi.height, width, 1);
+    arena_size += 3 * ComplexMat::arena_size(p_roi.height, width, model_channels);
+#endif
+    p_threadctxs.clear();
+    p_arena.reserve(arena_size);
+
+#ifdef CUFFT
+    p_rot_labels_data = DynMem(p_roi.width * p_roi.height * sizeof(float), p_arena);
+    p_rot_labels = cv::Mat(p_roi, CV_32FC1, p_rot_labels_data.hostMem());
+
+    p_model_xf.create(p_roi.height, width, p_num_of_feats);
+    p_yf.create(p_roi.height, width, 1);
+    p_xf.create(p_roi.height, width, p_num_of_feats);
+#else
+    p_model_xf.create(p_roi.height, width, p_num_of_feats, 1, p_arena);
+    p_yf.create(p_roi.height, width, 1, 1, p_arena);
+    p_xf.create(p_roi.height, width, p_num_of_feats, 1, p_arena);
+    p_model_alphaf.create(p_roi.height, width, model_channels, 1, p_arena);
+    p_model_alphaf_num.create(p_roi.height, width, model_channels, 1, p_arena);
+    p_model_alphaf_den.create(p_roi.height, width, model_channels, 1, p_arena);
+#endif
+
+    p_fft->init(p_roi.width, p_roi.height, p_num_of_feats, p_num_scales);
+
+    // The contexts transform their buffers concurrently with the plans of
+    // p_fft, which only works if the buffers have the right layout
+    bool buffers_ok = true;
+#ifndef CUFFT
+    buffers_ok = p_fft->check_buffer(p_xf, "xf") && p_fft->check_buffer(p_yf, "yf");
+#endif
+    p_threadctxs.reserve(max);
+    for (int i = 0; i < max; ++i) {
+        if (BIG_BATCH_MODE && i == 1)
+            p_threadctxs.emplace_back(p_roi, p_num_of_feats * p_num_scales, 1, p_num_scales, width, p_arena);
+        else
+            p_threadctxs.emplace_back(p_roi, p_num_of_feats, p_scales[i], 1, width, p_arena);
+        buffers_ok = p_fft->check_buffers(p_threadctxs.back()) && buffers_ok;
+    }
+    if (!buffers_ok) {
+        std::cerr << "The working buffers cannot be used with the " << p_fft->name() << " FFT." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    p_cos_window = cosine_window_function(p_roi.width, p_roi.height);
 }
 
 void KCF_Tracker::setTrackerPose(BBox_c &bbox, cv::Mat &img, int fit_size_x, int fit_size_y)
@@ -299,68 +441,184 @@ double KCF_Tracker::getFilterResponse() const
     return this->max_response;
 }
 
-void KCF_Tracker::track(cv::Mat &img)
+// Part of the (resized) frame read by get_features() at the given scale
+cv::Rect KCF_Tracker::feature_window(double scale) const
 {
-    if (m_debug) std::cout << "NEW FRAME" << '\n';
-    cv::Mat input_gray, input_rgb = img.clone();
-    if (img.channels() == 3) {
-        cv::cvtColor(img, input_gray, CV_BGR2GRAY);
-        input_gray.convertTo(input_gray, CV_32FC1);
-    } else
-        img.convertTo(input_gray, CV_32FC1);
+    int cx = int(p_pose.cx), cy = int(p_pose.cy);
+    int width = int(floor(p_windows_size.width * scale));
+    int height = int(floor(p_windows_size.height * scale));
+    return cv::Rect(cx - width / 2, cy - height / 2, width, height);
+}
 
-    // don't need too large image
-    if (p_resize_image) {
-        cv::resize(input_gray, input_gray, cv::Size(0, 0), p_downscale_factor, p_downscale_factor, cv::INTER_AREA);
-        cv::resize(input_rgb, input_rgb, cv::Size(0, 0), p_downscale_factor, p_downscale_factor, cv::INTER_AREA);
-    } else if (p_fit_to_pw2 && fabs(p_scale_factor_x - 1) > p_floating_error &&
-               fabs(p_scale_factor_y - 1) > p_floating_error) {
-        if (p_scale_factor_x < 1 && p_scale_factor_y < 1) {
-            cv::resize(input_gray, input_gray, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_AREA);
-            cv::resize(input_rgb, input_rgb, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_AREA);
-        } else {
-            cv::resize(input_gray, input_gray, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_LINEAR);
-            cv::resize(input_rgb, input_rgb, cv::Size(0, 0), p_scale_factor_x, p_scale_factor_y, cv::INTER_LINEAR);
+// Union of the feature windows of all scales searched by track()
+cv::Rect KCF_Tracker::search_region() const
+{
+    cv::Rect region = feature_window(p_current_scale * p_scales.front());
+    for (double scale : p_scales)
+        region |= feature_window(p_current_scale * scale);
+    return region;
+}
+
+// Converts the part of the frame covering region (given in the coordinates
+// of the resized frame) to the grayscale and color images the features are
+// computed from, and stores it in p_frame. The pixels are the same as if
+// the whole frame was converted and resized. The results are kept in member
+// buffers, which grow only when needed.
+void KCF_Tracker::preprocess_frame(const cv::Mat &img, cv::Rect region, bool init)
+{
+    bool resize = p_resize_image;
+    double fx = p_downscale_factor, fy = p_downscale_factor;
+    int interpolation = cv::INTER_AREA;
+    // init() resizes when any of the fit factors differs from 1, track() only when both do
+    if (!p_resize_image && p_fit_to_pw2 &&
+        (init ? fabs(p_scale_factor_x - 1) > p_floating_error || fabs(p_scale_factor_y - 1) > p_floating_error
+              : fabs(p_scale_factor_x - 1) > p_floating_error && fabs(p_scale_factor_y - 1) > p_floating_error)) {
+        resize = true;
+        fx = p_scale_factor_x;
+        fy = p_scale_factor_y;
+        if (!(fx < 1 && fy < 1))
+            interpolation = cv::INTER_LINEAR;
+    }
+
+    if (p_shared_frame && (!resize || p_resize_image)) {
+        const FrameRegion &shared = p_resize_image ? p_shared_frame->half : p_shared_frame->full;
+        if (!shared.gray.empty()) {
+            assert(!p_resize_image || p_downscale_factor == 0.5);
+            p_frame = shared;
+            return;
         }
     }
 
+    p_frame.size = resize ? cv::Size(cvRound(img.cols * fx), cvRound(img.rows * fy)) : img.size();
+    if (resize && !p_resize_image) {
+        // Interpolation weights of arbitrary factors depend on the position
+        // in the frame, so the whole frame is resized.
+        region = cv::Rect(cv::Point(0, 0), p_frame.size);
+    }
+    region &= cv::Rect(cv::Point(0, 0), p_frame.size);
+
+    cv::Rect src_region = region;
+    if (p_resize_image) {
+        // Downscaling by p_downscale_factor (1/2) averages 2x2 blocks. An
+        // even origin keeps the blocks, and the rounding of the resized
+        // size at the frame border, the same as for the whole frame.
+        assert(p_downscale_factor == 0.5);
+        region.width += region.x % 2;
+        region.height += region.y % 2;
+        region.x -= region.x % 2;
+        region.y -= region.y % 2;
+        src_region = cv::Rect(2 * region.x, 2 * region.y, std::min(2 * region.width, img.cols - 2 * region.x),
+                              std::min(2 * region.height, img.rows - 2 * region.y));
+    } else if (resize) {
+        src_region = cv::Rect(cv::Point(0, 0), img.size());
+    }
+    p_frame.roi = region;
+
+    if (region.area() == 0) {
+        // the target is out of the frame, the sub-windows are all zeros
+        p_frame.gray = buffer_mat(p_frame_gray, 0, 0, CV_32FC1);
+        p_frame.rgb = buffer_mat(p_frame_rgb_resized, 0, 0, img.type());
+        return;
+    }
+
+    cv::Mat src = img(src_region);
+    cv::Mat gray = buffer_mat(p_frame_gray, src.rows, src.cols, CV_32FC1);
+    if (img.channels() == 3) {
+        cv::Mat gray_u8 = buffer_mat(p_frame_gray_u8, src.rows, src.cols, CV_8UC1);
+        cv::cvtColor(src, gray_u8, CV_BGR2GRAY);
+        gray_u8.convertTo(gray, CV_32FC1);
+    } else
+        src.convertTo(gray, CV_32FC1);
+
+    if (resize) {
+        // don't need too large image
+        p_frame.gray = buffer_mat(p_frame_gray_resized, region.height, region.width, CV_32FC1);
+        p_frame.rgb = buffer_mat(p_frame_rgb_resized, region.height, region.width, img.type());
+        cv::resize(gray, p_frame.gray, cv::Size(0, 0), fx, fy, interpolation);
+        cv::resize(src, p_frame.rgb, cv::Size(0, 0), fx, fy, interpolation);
+        assert(p_frame.gray.size() == region.size() && p_frame.rgb.size() == region.size());
+    } else {
+        p_frame.gray = gray;
+        p_frame.rgb = src;
+    }
+}
+
+void KCF_Tracker::track(cv::Mat &img, const PreprocessedFrame &frame)
+{
+    p_shared_frame = &frame;
+    track(img);
+    p_shared_frame = nullptr;
+}
+
+void KCF_Tracker::track(cv::Mat &img)
+{
+    if (m_debug) std::cout << "NEW FRAME" << '\n';
+    // only the part of the frame covered by the search windows is used
+    preprocess_frame(img, search_region());
+    track_scales();
+    track_update(img);
+}
+
+void KCF_Tracker::trackFeatures(cv::Mat &img, const PreprocessedFrame &frame)
+{
+    if (m_debug) std::cout << "NEW FRAME" << '\n';
+    p_shared_frame = &frame;
+    preprocess_frame(img, search_region());
+    if (use_feature_pyramid())
+        pyramid_features(p_frame);
+    for (ThreadCtx &ctx : p_threadctxs)
+        scale_features(ctx, p_frame);
+}
+
+void KCF_Tracker::windowJobs(std::vector<Fft::WindowJob> &jobs)
+{
+    for (ThreadCtx &ctx : p_threadctxs)
+        jobs.push_back(Fft::WindowJob{&ctx.fw_all, &ctx.zf, m_use_cuda ? ctx.data_features.deviceMem() : nullptr,
+                                      ctx.stream});
+}
+
+void KCF_Tracker::trackUpdate(cv::Mat &img)
+{
+    for (ThreadCtx &ctx : p_threadctxs)
+        scale_response(ctx);
+    track_update(img);
+    p_shared_frame = nullptr;
+}
+
+// Localizes the target from the responses of all scales and updates the model
+void KCF_Tracker::track_update(cv::Mat &img)
+{
     max_response = -1.;
     ThreadCtx *max = nullptr;
+    uint max_idx = 0; // scale index in max->zf
+    uint scale_idx = 0; // index of the best scale in p_scales
+    double max_scale = 1.;
     cv::Point2i *max_response_pt = nullptr;
     cv::Mat *max_response_map = nullptr;
 
-#ifdef ASYNC
-    for (auto &it : p_threadctxs)
-        it.async_res = std::async(std::launch::async, [this, &input_gray, &input_rgb, &it]() -> void {
-            scale_track(it, input_rgb, input_gray);
-        });
-    for (auto const &it : p_threadctxs)
-        it.async_res.wait();
-
-#else  // !ASYNC
-    // FIXME: Iterate correctly in big batch mode - perhaps have only one element in the list
-    NORMAL_OMP_PARALLEL_FOR
-    for (uint i = 0; i < p_threadctxs.size(); ++i)
-        scale_track(p_threadctxs[i], input_rgb, input_gray);
-#endif
-
 #ifndef BIG_BATCH
-    for (auto &it : p_threadctxs) {
+    for (uint j = 0; j < p_threadctxs.size(); ++j) {
+        ThreadCtx &it = p_threadctxs[j];
         if (it.max_response > max_response) {
             max_response = it.max_response;
             max_response_pt = &it.max_loc;
             max_response_map = &it.response;
             max = &it;
+            scale_idx = j;
+            max_scale = it.scale;
         }
     }
 #else
     // FIXME: Iterate correctly in big batch mode - perhaps have only one element in the list
     for (uint j = 0; j < p_scales.size(); ++j) {
-        if (p_threadctxs[0].max_responses[j] > max_response) {
-            max_response = p_threadctxs[0].max_responses[j];
-            max_response_pt = &p_threadctxs[0].max_locs[j];
-            max_response_map = &p_threadctxs[0].response_maps[j];
-            max = &p_threadctxs[0];
+        if (p_threadctxs.back().max_responses[j] > max_response) {
+            max_response = p_threadctxs.back().max_responses[j];
+            max_response_pt = &p_threadctxs.back().max_locs[j];
+            max_response_map = &p_threadctxs.back().response_maps[j];
+            max = &p_threadctxs.back();
+            max_idx = j;
+            scale_idx = j;
+            max_scale = p_scales[j];
         }
     }
 #endif
@@ -381,6 +639,8 @@ void KCF_Tracker::track(cv::Mat &img)
         new_location = sub_pixel_peak(*max_response_pt, *max_response_map);
     DEBUG_PRINT(new_location);
 
+    int old_cx = int(p_pose.cx), old_cy = int(p_pose.cy);
+    double max_cell = p_cell_size * p_current_scale * max_scale; // cell of the best patch in frame pixels
     p_pose.cx += p_current_scale * p_cell_size * double(new_location.x);
     p_pose.cy += p_current_scale * p_cell_size * double(new_location.y);
     if (p_fit_to_pw2) {
@@ -392,44 +652,59 @@ void KCF_Tracker::track(cv::Mat &img)
     }
 
     // sub grid scale interpolation
-    if (m_use_subgrid_scale) {
-        auto it = std::find_if(p_threadctxs.begin(), p_threadctxs.end(), [max](ThreadCtx &ctx) { return &ctx == max; });
-        p_current_scale *= sub_grid_scale(std::distance(p_threadctxs.begin(), it));
-    } else {
-        p_current_scale *= max->scale;
-    }
+    if (m_use_subgrid_scale)
+        p_current_scale *= sub_grid_scale(scale_idx);
+    else
+        p_current_scale *= max_scale;
 
     clamp2(p_current_scale, p_min_max_scale[0], p_min_max_scale[1]);
 
     ThreadCtx &ctx = p_threadctxs.front();
-    // obtain a subwindow for training at newly estimated target position
-    std::vector<cv::Mat> patch_feats = get_features(input_rgb, input_gray, p_pose.cx, p_pose.cy,
-                                                    p_windows_size.width, p_windows_size.height,
-                                                    p_current_scale);
-    fft.forward_window(patch_feats, p_xf, ctx.fw_all,
-                       m_use_cuda ? ctx.data_features.deviceMem() : nullptr, ctx.stream);
+    // target shift in the cells of the best patch, as seen by get_features()
+    double shift_x = (int(p_pose.cx) - old_cx) / max_cell;
+    double shift_y = (int(p_pose.cy) - old_cy) / max_cell;
+    // the detection features of the pyramid are resampled, the model is
+    // trained on exactly extracted ones
+    if (m_reuse_detection_features && !use_feature_pyramid() &&
+        std::max(fabs(shift_x), fabs(shift_y)) <= m_max_reuse_shift) {
+        // The features of the best scale, cyclically shifted to the new
+        // position, approximate the training patch. The cosine window and
+        // the patch edges move with them, and the scale is the detected one
+        // without the sub-grid interpolation.
+        p_xf.set_shifted(max->zf, max_idx * p_num_of_feats, p_num_of_feats, float(shift_x), float(shift_y),
+                         uint(p_roi.width));
+    } else {
+        // obtain a subwindow for training at newly estimated target position
+        cv::Rect train_window = feature_window(p_current_scale) & cv::Rect(cv::Point(0, 0), p_frame.size);
+        if ((train_window & p_frame.roi) != train_window)
+            preprocess_frame(img, train_window);
+        get_features(p_frame, p_pose.cx, p_pose.cy, p_windows_size.width, p_windows_size.height,
+                     p_current_scale, ctx.feature_buffers.front(), ctx.fw_all);
+        p_fft->forward_window(ctx.fw_all, p_xf,
+                           m_use_cuda ? ctx.data_features.deviceMem() : nullptr, ctx.stream);
+    }
 
     // subsequent frames, interpolate model
     p_model_xf = p_model_xf * float((1. - p_interp_factor)) + p_xf * float(p_interp_factor);
 
-    ComplexMat alphaf_num, alphaf_den;
-
+    // the new alphaf numerator and denominator are interpolated into the
+    // model directly, each update is evaluated as one fused expression
     if (m_use_linearkernel) {
-        ComplexMat xfconj = p_xf.conj();
-        alphaf_num = xfconj.mul(p_yf);
-        alphaf_den = (p_xf * xfconj);
+        p_model_alphaf_num = p_model_alphaf_num * float((1. - p_interp_factor)) +
+                             p_xf.conj().mul(p_yf) * float(p_interp_factor);
+        p_model_alphaf_den = p_model_alphaf_den * float((1. - p_interp_factor)) +
+                             (p_xf * p_xf.conj()) * float(p_interp_factor);
     } else {
         // Kernel Ridge Regression, calculate alphas (in Fourier domain)
-        gaussian_correlation(ctx, p_xf, p_xf, p_kernel_sigma,
-                             true);
+        gaussian_correlation(*p_fft, ctx, p_xf, p_xf, p_kernel_sigma, true);
         //        ComplexMat alphaf = p_yf / (kf + p_lambda); //equation for fast training
         //        p_model_alphaf = p_model_alphaf * (1. - p_interp_factor) + alphaf * p_interp_factor;
-        alphaf_num = p_yf * ctx.kf;
-        alphaf_den = ctx.kf * (ctx.kf + float(p_lambda));
+        p_model_alphaf_num = p_model_alphaf_num * float((1. - p_interp_factor)) +
+                             (p_yf * ctx.kf) * float(p_interp_factor);
+        p_model_alphaf_den = p_model_alphaf_den * float((1. - p_interp_factor)) +
+                             (ctx.kf * (ctx.kf + float(p_lambda))) * float(p_interp_factor);
     }
 
-    p_model_alphaf_num = p_model_alphaf_num * float((1. - p_interp_factor)) + alphaf_num * float(p_interp_factor);
-    p_model_alphaf_den = p_model_alphaf_den * float((1. - p_interp_factor)) + alphaf_den * float(p_interp_factor);
     p_model_alphaf = p_model_alphaf_num / p_model_alphaf_den;
 
 #if  !defined(BIG_BATCH) && defined(CUFFT) && (defined(ASYNC) || defined(OPENMP))
@@ -442,41 +717,78 @@ void KCF_Tracker::track(cv::Mat &img)
 #endif
 }
 
-void KCF_Tracker::scale_track(ThreadCtx &vars, cv::Mat &input_rgb, cv::Mat &input_gray)
+// Runs scale_track() for all p_threadctxs on p_frame
+void KCF_Tracker::track_scales()
 {
-    std::vector<cv::Mat> patch_feats;
-    if (BIG_BATCH_MODE) {
-        BIG_BATCH_OMP_PARALLEL_FOR
-        for (uint i = 0; i < p_num_scales; ++i) {
-            patch_feats = get_features(input_rgb, input_gray, this->p_pose.cx, this->p_pose.cy,
-                                       this->p_windows_size.width, this->p_windows_size.height,
-                                       this->p_current_scale * this->p_scales[i]);
-        }
-    } else {
-        patch_feats = get_features(input_rgb, input_gray, this->p_pose.cx, this->p_pose.cy,
-                                   this->p_windows_size.width, this->p_windows_size.height,
-                                   this->p_current_scale * vars.scale);
+    if (use_feature_pyramid())
+        pyramid_features(p_frame);
+    if (!m_use_multithreading) {
+        for (uint i = 0; i < p_threadctxs.size(); ++i)
+            scale_track(p_threadctxs[i], p_frame);
+        return;
     }
+#ifdef ASYNC
+    auto task = [this](unsigned i) { scale_track(p_threadctxs[i], p_frame); };
+    p_pool->parallel_for(unsigned(p_threadctxs.size()), task);
+#else  // !ASYNC
+    // FIXME: Iterate correctly in big batch mode - perhaps have only one element in the list
+    NORMAL_OMP_PARALLEL_FOR
+    for (uint i = 0; i < p_threadctxs.size(); ++i)
+        scale_track(p_threadctxs[i], p_frame);
+#endif
+}
 
-    fft.forward_window(patch_feats, vars.zf, vars.fw_all, m_use_cuda ? vars.data_features.deviceMem() : nullptr,
+void KCF_Tracker::scale_track(ThreadCtx &vars, const FrameRegion &frame)
+{
+    scale_features(vars, frame);
+    p_fft->forward_window(vars.fw_all, vars.zf, m_use_cuda ? vars.data_features.deviceMem() : nullptr,
                        vars.stream);
+    scale_response(vars);
+}
+
+// Computes the windowed features of the scales of vars into vars.fw_all
+void KCF_Tracker::scale_features(ThreadCtx &vars, const FrameRegion &frame)
+{
+    // In big batch mode, every scale writes its features into its own
+    // block of rows of vars.fw_all
+    uint n_scales = uint(vars.feature_buffers.size());
+    int scale_rows = int(p_num_of_feats) * p_roi.height;
+    bool from_pyramid = use_feature_pyramid();
+    BIG_BATCH_OMP_PARALLEL_FOR
+    for (uint i = 0; i < n_scales; ++i) {
+        double scale = n_scales > 1 ? this->p_scales[i] : vars.scale;
+        cv::Mat feats = vars.fw_all.rowRange(int(i) * scale_rows, int(i + 1) * scale_rows);
+        get_features(frame, this->p_pose.cx, this->p_pose.cy, this->p_windows_size.width,
+                     this->p_windows_size.height, this->p_current_scale * scale, vars.feature_buffers[i], feats,
+                     from_pyramid);
+    }
+}
+
+// Computes the responses of the scales of vars from vars.zf
+void KCF_Tracker::scale_response(ThreadCtx &vars)
+{
     DEBUG_PRINTM(vars.zf);
 
     if (m_use_linearkernel) {
-        vars.kzf = BIG_BATCH_MODE ? (vars.zf.mul2(this->p_model_alphaf)).sum_over_channels()
-                                   : (p_model_alphaf * vars.zf).sum_over_channels();
-        fft.inverse(vars.kzf, vars.response, m_use_cuda ? vars.data_i_1ch.deviceMem() : nullptr, vars.stream);
+        if (BIG_BATCH_MODE)
+            vars.kzf = (vars.zf.mul2(this->p_model_alphaf)).sum_over_channels();
+        else
+            vars.kzf = (p_model_alphaf * vars.zf).sum_over_channels();
+        p_fft->inverse(vars.kzf, vars.response, m_use_cuda ? vars.data_i_1ch.deviceMem() : nullptr, vars.stream);
     } else {
 #if !defined(BIG_BATCH) && defined(CUFFT) && (defined(ASYNC) || defined(OPENMP))
-        gaussian_correlation(vars, vars.zf, vars.model_xf, this->p_kernel_sigma);
+        gaussian_correlation(*p_fft, vars, vars.zf, vars.model_xf, this->p_kernel_sigma);
         vars.kzf = vars.model_alphaf * vars.kzf;
 #else
-        gaussian_correlation(vars, vars.zf, this->p_model_xf, this->p_kernel_sigma);
+        gaussian_correlation(*p_fft, vars, vars.zf, this->p_model_xf, this->p_kernel_sigma);
         DEBUG_PRINTM(this->p_model_alphaf);
         DEBUG_PRINTM(vars.kzf);
-        vars.kzf = BIG_BATCH_MODE ? vars.kzf.mul(this->p_model_alphaf) : this->p_model_alphaf * vars.kzf;
+        if (BIG_BATCH_MODE)
+            vars.kzf = vars.kzf.mul(this->p_model_alphaf);
+        else
+            vars.kzf = this->p_model_alphaf * vars.kzf;
 #endif
-        fft.inverse(vars.kzf, vars.response, m_use_cuda ? vars.data_i_1ch.deviceMem() : nullptr, vars.stream);
+        p_fft->inverse(vars.kzf, vars.response, m_use_cuda ? vars.data_i_1ch.deviceMem() : nullptr, vars.stream);
     }
 
     DEBUG_PRINTM(vars.response);
@@ -488,12 +800,13 @@ void KCF_Tracker::scale_track(ThreadCtx &vars, cv::Mat &input_rgb, cv::Mat &inpu
 #ifdef BIG_BATCH
     cv::split(vars.response, vars.response_maps);
 
-    for (size_t i = 0; i < p_scales.size(); ++i) {
+    for (size_t i = 0; i < vars.response_maps.size(); ++i) {
         double min_val, max_val;
         cv::Point2i min_loc, max_loc;
         cv::minMaxLoc(vars.response_maps[i], &min_val, &max_val, &min_loc, &max_loc);
         DEBUG_PRINT(max_loc);
-        double weight = p_scales[i] < 1. ? p_scales[i] : 1. / p_scales[i];
+        double scale = vars.response_maps.size() > 1 ? p_scales[i] : vars.scale;
+        double weight = scale < 1. ? scale : 1. / scale;
         vars.max_responses[i] = max_val * weight;
         vars.max_locs[i] = max_loc;
     }
@@ -512,56 +825,147 @@ void KCF_Tracker::scale_track(ThreadCtx &vars, cv::Mat &input_rgb, cv::Mat &inpu
 
 // ****************************************************************************
 
-std::vector<cv::Mat> KCF_Tracker::get_features(cv::Mat & input_rgb, cv::Mat & input_gray, int cx, int cy, int size_x, int size_y, double scale)
+// Computes the feature channels of the patch at [cx, cy], multiplied by the
+// cosine window, into feats (p_num_of_feats blocks of p_roi.height rows).
+// This is the only place where the FFT input is written. All intermediate
+// images are kept in buf. With from_pyramid, the HOG channels are resampled
+// from p_pyramid, which must have been computed by pyramid_features() for
+// the current frame.
+void KCF_Tracker::get_features(const FrameRegion &frame, int cx, int cy, int size_x, int size_y, double scale,
+                               FeatureBuffers &buf, cv::Mat &feats, bool from_pyramid)
 {
     int size_x_scaled = floor(size_x * scale);
     int size_y_scaled = floor(size_y * scale);
+    int chn_stride = p_roi.height * int(feats.step1());
 
-    cv::Mat patch_gray = get_subwindow(input_gray, cx, cy, size_x_scaled, size_y_scaled);
-    cv::Mat patch_rgb = get_subwindow(input_rgb, cx, cy, size_x_scaled, size_y_scaled);
+    cv::Mat patch_rgb = get_subwindow(frame.rgb, frame, cx, cy, size_x_scaled, size_y_scaled, buf.rgb_buf);
 
-    // resize to default size
-    if (scale > 1.) {
-        // if we downsample use  INTER_AREA interpolation
-        cv::resize(patch_gray, patch_gray, cv::Size(size_x, size_y), 0., 0., cv::INTER_AREA);
+    if (from_pyramid) {
+        pyramid_hog(scale / p_current_scale, buf, feats);
     } else {
-        cv::resize(patch_gray, patch_gray, cv::Size(size_x, size_y), 0., 0., cv::INTER_LINEAR);
-    }
+        cv::Mat patch_gray = get_subwindow(frame.gray, frame, cx, cy, size_x_scaled, size_y_scaled, buf.gray_buf);
 
-    // get hog(Histogram of Oriented Gradients) features
-    std::vector<cv::Mat> hog_feat = FHoG::extract(patch_gray, 2, p_cell_size, 9);
+        // resize to default size
+        if (scale > 1.) {
+            // if we downsample use  INTER_AREA interpolation
+            cv::resize(patch_gray, buf.gray_resized, cv::Size(size_x, size_y), 0., 0., cv::INTER_AREA);
+        } else {
+            cv::resize(patch_gray, buf.gray_resized, cv::Size(size_x, size_y), 0., 0., cv::INTER_LINEAR);
+        }
+
+        // get hog(Histogram of Oriented Gradients) features
+        FHoG::extract(buf.gray_resized, feats.ptr<float>(), int(feats.step1()), chn_stride, p_cos_window, p_cell_size,
+                      9);
+    }
+    int channel = FHoG::num_channels(2, 9);
 
     // get color rgb features (simple r,g,b channels)
-    std::vector<cv::Mat> color_feat;
-    if ((m_use_color || m_use_cnfeat) && input_rgb.channels() == 3) {
+    if (frame.rgb.channels() != 3) {
+        // no color features for grayscale images
+        if (channel < int(p_num_of_feats))
+            feats.rowRange(channel * p_roi.height, feats.rows).setTo(0.);
+        return;
+    }
+
+    if (m_use_color || m_use_cnfeat) {
         // resize to default size
         if (scale > 1.) {
             // if we downsample use  INTER_AREA interpolation
-            cv::resize(patch_rgb, patch_rgb, cv::Size(size_x / p_cell_size, size_y / p_cell_size), 0., 0., cv::INTER_AREA);
+            cv::resize(patch_rgb, buf.rgb_resized, cv::Size(size_x / p_cell_size, size_y / p_cell_size), 0., 0., cv::INTER_AREA);
         } else {
-            cv::resize(patch_rgb, patch_rgb, cv::Size(size_x / p_cell_size, size_y / p_cell_size), 0., 0., cv::INTER_LINEAR);
+            cv::resize(patch_rgb, buf.rgb_resized, cv::Size(size_x / p_cell_size, size_y / p_cell_size), 0., 0., cv::INTER_LINEAR);
         }
     }
 
-    if (m_use_color && input_rgb.channels() == 3) {
-        // use rgb color space
-        cv::Mat patch_rgb_norm;
-        patch_rgb.convertTo(patch_rgb_norm, CV_32F, 1. / 255., -0.5);
-        cv::Mat ch1(patch_rgb_norm.size(), CV_32FC1);
-        cv::Mat ch2(patch_rgb_norm.size(), CV_32FC1);
-        cv::Mat ch3(patch_rgb_norm.size(), CV_32FC1);
-        std::vector<cv::Mat> rgb = {ch1, ch2, ch3};
-        cv::split(patch_rgb_norm, rgb);
-        color_feat.insert(color_feat.end(), rgb.begin(), rgb.end());
+    if (m_use_color) {
+        // use rgb color space, normalized to [-0.5, 0.5]
+        for (int y = 0; y < p_roi.height; ++y) {
+            const cv::Vec3b *src = buf.rgb_resized.ptr<cv::Vec3b>(y);
+            const float *win = p_cos_window.ptr<float>(y);
+            for (int c = 0; c < 3; ++c) {
+                float *dst = feats.ptr<float>((channel + c) * p_roi.height + y);
+                for (int x = 0; x < p_roi.width; ++x)
+                    dst[x] = (src[x][c] * (1.f / 255.f) - 0.5f) * win[x];
+            }
+        }
+        channel += 3;
     }
 
-    if (m_use_cnfeat && input_rgb.channels() == 3) {
-        std::vector<cv::Mat> cn_feat = CNFeat::extract(patch_rgb);
-        color_feat.insert(color_feat.end(), cn_feat.begin(), cn_feat.end());
+    if (m_use_cnfeat)
+        CNFeat::extract(buf.rgb_resized, feats.ptr<float>(channel * p_roi.height), chn_stride, p_cos_window);
+}
+
+// Computes the HOG channels of the window of the largest scale at the
+// resolution of the smallest scale into p_pyramid
+void KCF_Tracker::pyramid_features(const FrameRegion &frame)
+{
+    double min_scale = p_scales.front(), max_scale = p_scales.back();
+    double scale = p_current_scale * max_scale;
+    int size_x_scaled = floor(p_windows_size.width * scale);
+    int size_y_scaled = floor(p_windows_size.height * scale);
+    p_pyramid.roi = cv::Size(int(round(p_roi.width * max_scale / min_scale)),
+                             int(round(p_roi.height * max_scale / min_scale)));
+
+    cv::Mat patch_gray = get_subwindow(frame.gray, frame, p_pose.cx, p_pose.cy, size_x_scaled, size_y_scaled,
+                                       p_pyramid.buf.gray_buf);
+    cv::Size size(p_pyramid.roi.width * p_cell_size, p_pyramid.roi.height * p_cell_size);
+    if (p_current_scale * min_scale > 1.)
+        cv::resize(patch_gray, p_pyramid.buf.gray_resized, size, 0., 0., cv::INTER_AREA);
+    else
+        cv::resize(patch_gray, p_pyramid.buf.gray_resized, size, 0., 0., cv::INTER_LINEAR);
+
+    p_pyramid.hog.create(FHoG::num_channels(2, 9) * p_pyramid.roi.height, p_pyramid.roi.width, CV_32F);
+    FHoG::extract(p_pyramid.buf.gray_resized, p_pyramid.hog.ptr<float>(), p_pyramid.roi.width,
+                  p_pyramid.roi.area(), cv::Mat(), p_cell_size, 9);
+}
+
+// Source cells src[i] and src[i] + 1 and the weight w[i] of the second one
+// for the linear interpolation of n cells from the src_n cells starting at
+// begin, step cells apart (all in source cells)
+static void resampling_table(int n, int src_n, double begin, double step, std::vector<int> &src,
+                             std::vector<float> &w)
+{
+    src.resize(n);
+    w.resize(n);
+    for (int i = 0; i < n; ++i) {
+        double pos = begin + (i + 0.5) * step - 0.5;
+        clamp2(pos, 0., src_n - 1.);
+        src[i] = std::min(int(pos), src_n - 2);
+        w[i] = float(pos - src[i]);
     }
+}
 
-    hog_feat.insert(hog_feat.end(), color_feat.begin(), color_feat.end());
-    return hog_feat;
+// Resamples the HOG channels of the window of the given scale (relative to
+// p_current_scale) from p_pyramid to feats, multiplied by the cosine window.
+// The resampled channels are corrected by the power law of the fast feature
+// pyramids (P. Dollar et al., "Fast Feature Pyramids for Object Detection",
+// TPAMI 2014).
+void KCF_Tracker::pyramid_hog(double scale, FeatureBuffers &buf, cv::Mat &feats)
+{
+    const cv::Size &src_roi = p_pyramid.roi;
+    double part = scale / p_scales.back(); // of the pyramid window covered by the scale
+    resampling_table(p_roi.width, src_roi.width, src_roi.width * (1. - part) / 2., src_roi.width * part / p_roi.width,
+                     buf.pyramid_x, buf.pyramid_wx);
+    resampling_table(p_roi.height, src_roi.height, src_roi.height * (1. - part) / 2.,
+                     src_roi.height * part / p_roi.height, buf.pyramid_y, buf.pyramid_wy);
+    float factor = float(std::pow(scale / p_scales.front(), m_pyramid_lambda));
+
+    for (int c = 0; c < FHoG::num_channels(2, 9); ++c) {
+        for (int y = 0; y < p_roi.height; ++y) {
+            const float *src0 = p_pyramid.hog.ptr<float>(c * src_roi.height + buf.pyramid_y[y]);
+            const float *src1 = src0 + src_roi.width;
+            const float *win = p_cos_window.ptr<float>(y);
+            float *dst = feats.ptr<float>(c * p_roi.height + y);
+            float wy = buf.pyramid_wy[y];
+            for (int x = 0; x < p_roi.width; ++x) {
+                int sx = buf.pyramid_x[x];
+                float wx = buf.pyramid_wx[x];
+                float top = src0[sx] + (src0[sx + 1] - src0[sx]) * wx;
+                float bottom = src1[sx] + (src1[sx + 1] - src1[sx]) * wx;
+                dst[x] = (top + (bottom - top) * wy) * factor * win[x];
+            }
+        }
+    }
 }
 
 cv::Mat KCF_Tracker::gaussian_shaped_labels(double sigma, int dim1, int dim2)
@@ -676,10 +1080,13 @@ cv::Mat KCF_Tracker::cosine_window_function(int dim1, int dim2)
 
 // Returns sub-window of image input centered at [cx, cy] coordinates),
 // with size [width, height]. If any pixels are outside of the image,
-// they will replicate the values at the borders.
-cv::Mat KCF_Tracker::get_subwindow(const cv::Mat &input, int cx, int cy, int width, int height)
+// they will replicate the values at the borders. The patch is stored in buf,
+// which grows only when the patch does not fit.
+// input holds the frame.roi part of the frame, cx, cy are frame coordinates
+cv::Mat KCF_Tracker::get_subwindow(const cv::Mat &input, const FrameRegion &frame, int cx, int cy, int width,
+                                   int height, cv::Mat &buf)
 {
-    cv::Mat patch;
+    cv::Mat patch = buffer_mat(buf, height, width, input.type());
 
     int x1 = cx - width / 2;
     int y1 = cy - height / 2;
@@ -687,8 +1094,7 @@ cv::Mat KCF_Tracker::get_subwindow(const cv::Mat &input, int cx, int cy, int wid
     int y2 = cy + height / 2;
 
     // out of image
-    if (x1 >= input.cols || y1 >= input.rows || x2 < 0 || y2 < 0) {
-        patch.create(height, width, input.type());
+    if (x1 >= frame.size.width || y1 >= frame.size.height || x2 < 0 || y2 < 0) {
         patch.setTo(double(0.f));
         return patch;
     }
@@ -704,23 +1110,26 @@ cv::Mat KCF_Tracker::get_subwindow(const cv::Mat &input, int cx, int cy, int wid
         top = -y1;
         y1 = 0;
     }
-    if (x2 >= input.cols) {
-        right = x2 - input.cols + width % 2;
-        x2 = input.cols;
+    if (x2 >= frame.size.width) {
+        right = x2 - frame.size.width + width % 2;
+        x2 = frame.size.width;
     } else
         x2 += width % 2;
 
-    if (y2 >= input.rows) {
-        bottom = y2 - input.rows + height % 2;
-        y2 = input.rows;
+    if (y2 >= frame.size.height) {
+        bottom = y2 - frame.size.height + height % 2;
+        y2 = frame.size.height;
     } else
         y2 += height % 2;
 
     if (x2 - x1 == 0 || y2 - y1 == 0)
-        patch = cv::Mat::zeros(height, width, CV_32FC1);
+        patch.setTo(double(0.f));
     else {
-        cv::copyMakeBorder(input(cv::Range(y1, y2), cv::Range(x1, x2)), patch, top, bottom, left, right,
-                           cv::BORDER_REPLICATE);
+        // preprocess_frame() made sure that frame.roi covers the sub-window
+        assert(x1 >= frame.roi.x && x2 <= frame.roi.x + frame.roi.width);
+        assert(y1 >= frame.roi.y && y2 <= frame.roi.y + frame.roi.height);
+        cv::Range rows(y1 - frame.roi.y, y2 - frame.roi.y), cols(x1 - frame.roi.x, x2 - frame.roi.x);
+        cv::copyMakeBorder(input(rows, cols), patch, top, bottom, left, right, cv::BORDER_REPLICATE);
         //      imshow( "copyMakeBorder", patch);
         //      cv::waitKey();
     }
@@ -731,8 +1140,8 @@ cv::Mat KCF_Tracker::get_subwindow(const cv::Mat &input, int cx, int cy, int wid
     return patch;
 }
 
-void KCF_Tracker::gaussian_correlation(struct ThreadCtx &vars, const ComplexMat &xf, const ComplexMat &yf,
-                                       double sigma, bool auto_correlation)
+void gaussian_correlation(Fft &fft, ThreadCtx &vars, const ComplexMat &xf, const ComplexMat &yf, double sigma,
+                          bool auto_correlation)
 {
     xf.sqr_norm(vars.xf_sqr_norm);
     if (auto_correlation) {
@@ -740,54 +1149,45 @@ void KCF_Tracker::gaussian_correlation(struct ThreadCtx &vars, const ComplexMat
     } else {
         yf.sqr_norm(vars.yf_sqr_norm);
     }
-    vars.xyf = auto_correlation ? xf.sqr_mag() : xf.mul2(yf.conj());
-    DEBUG_PRINTM(vars.xyf);
-    fft.inverse(vars.xyf, vars.ifft2_res, m_use_cuda ? vars.data_i_features.deviceMem() : nullptr, vars.stream);
 #ifdef CUFFT
+    if (auto_correlation)
+        vars.xyf = xf.sqr_mag();
+    else
+        vars.xyf = xf.mul2(yf.conj());
+    fft.inverse(vars.xyf, vars.ifft2_res, vars.data_i_features.deviceMem(), vars.stream);
     cuda_gaussian_correlation(vars.data_i_features.deviceMem(), vars.gauss_corr_res.deviceMem(),
                               vars.xf_sqr_norm.deviceMem(), vars.xf_sqr_norm.deviceMem(), sigma, xf.n_channels,
-                              xf.n_scales, p_roi.height, p_roi.width, vars.stream);
+                              xf.n_scales, vars.ifft2_res.rows, vars.ifft2_res.cols, vars.stream);
 #else
-    // ifft2 and sum over 3rd dimension, we dont care about individual channels
-    DEBUG_PRINTM(vars.ifft2_res);
-    cv::Mat xy_sum;
-    if (xf.channels() != p_num_scales * p_num_of_feats)
-        xy_sum.create(vars.ifft2_res.size(), CV_32FC1);
+    // We dont care about individual channels, only about their sum. As the
+    // ifft2 is linear, the sum over 3rd dimension is computed in the Fourier
+    // domain and only one channel per scale is transformed back.
+    if (auto_correlation)
+        vars.xyf = xf.sqr_mag().sum_over_channels();
     else
-        xy_sum.create(vars.ifft2_res.size(), CV_32FC(p_scales.size()));
-    xy_sum.setTo(0);
-    for (int y = 0; y < vars.ifft2_res.rows; ++y) {
-        float *row_ptr = vars.ifft2_res.ptr<float>(y);
-        float *row_ptr_sum = xy_sum.ptr<float>(y);
-        for (int x = 0; x < vars.ifft2_res.cols; ++x) {
-            for (int sum_ch = 0; sum_ch < xy_sum.channels(); ++sum_ch) {
-                row_ptr_sum[(x * xy_sum.channels()) + sum_ch] += std::accumulate(
-                    row_ptr + x * vars.ifft2_res.channels() + sum_ch * (vars.ifft2_res.channels() / xy_sum.channels()),
-                    (row_ptr + x * vars.ifft2_res.channels() +
-                     (sum_ch + 1) * (vars.ifft2_res.channels() / xy_sum.channels())),
-                    0.f);
-            }
-        }
-    }
-    DEBUG_PRINTM(xy_sum);
-
-    std::vector<cv::Mat> scales;
-    cv::split(xy_sum, scales);
-
-    float numel_xf_inv = 1.f / (xf.cols * xf.rows * (xf.channels() / xf.n_scales));
+        vars.xyf = xf.mul2(yf.conj()).sum_over_channels();
+    cv::Mat xy_sum(vars.ifft2_res.size(), CV_32FC(vars.xyf.n_channels), vars.ifft2_res.data);
+    fft.inverse(vars.xyf, xy_sum, nullptr, vars.stream);
+
+    // in_all = exp(-1 / sigma^2 * max(0, (xx + yy - 2 * xy) / numel_xf)), fused into a single pass.
+    // xy_sum is not normalized by the inverse FFT, its 1 / (rows * cols) is
+    // part of the factor of xy.
+    double numel_xf_inv = 1. / (xf.cols * xf.rows * (xf.channels() / xf.n_scales));
+    double c = numel_xf_inv / (sigma * sigma);
+    double xy_inv = 1. / (xy_sum.cols * xy_sum.rows);
     for (uint i = 0; i < xf.n_scales; ++i) {
-        cv::Mat in_roi(vars.in_all, cv::Rect(0, i * scales[0].rows, scales[0].cols, scales[0].rows));
-        cv::exp(
-            -1. / (sigma * sigma) *
-                cv::max((double(vars.xf_sqr_norm.hostMem()[i] + vars.yf_sqr_norm.hostMem()[0]) - 2 * scales[i]) * double(numel_xf_inv), 0),
-            in_roi);
-        DEBUG_PRINTM(in_roi);
+        cv::Mat in_roi(vars.in_all, cv::Rect(0, i * xy_sum.rows, xy_sum.cols, xy_sum.rows));
+        double xx_yy = double(vars.xf_sqr_norm.hostMem()[i]) + vars.yf_sqr_norm.hostMem()[0];
+        simd_kernels().gaussian_exp(in_roi.ptr<float>(), xy_sum.ptr<float>() + i, xy_sum.channels(), xy_sum.total(),
+                                    float(-xx_yy * c), float(2 * c * xy_inv));
     }
 #endif
-    DEBUG_PRINTM(vars.in_all);
-    fft.forward(vars.in_all, auto_correlation ? vars.kf : vars.kzf, m_use_cuda ? vars.gauss_corr_res.deviceMem() : nullptr,
-                vars.stream);
-    return;
+#ifdef CUFFT
+    float *in_all_arr = vars.gauss_corr_res.deviceMem();
+#else
+    float *in_all_arr = nullptr;
+#endif
+    fft.forward(vars.in_all, auto_correlation ? vars.kf : vars.kzf, in_all_arr, vars.stream);
 }
 
 float get_response_circular(cv::Point2i &pt, cv::Mat &response)
@@ -804,46 +1204,35 @@ float get_response_circular(cv::Point2i &pt, cv::Mat &response)
 
 cv::Point2f KCF_Tracker::sub_pixel_peak(cv::Point &max_loc, cv::Mat &response)
 {
-    // find neighbourhood of max_loc (response is circular)
-    // 1 2 3
-    // 4   5
-    // 6 7 8
-    cv::Point2i p1(max_loc.x - 1, max_loc.y - 1), p2(max_loc.x, max_loc.y - 1), p3(max_loc.x + 1, max_loc.y - 1);
-    cv::Point2i p4(max_loc.x - 1, max_loc.y), p5(max_loc.x + 1, max_loc.y);
-    cv::Point2i p6(max_loc.x - 1, max_loc.y + 1), p7(max_loc.x, max_loc.y + 1), p8(max_loc.x + 1, max_loc.y + 1);
-
-    // clang-format off
-    // fit 2d quadratic function f(x, y) = a*x^2 + b*x*y + c*y^2 + d*x + e*y + f
-    cv::Mat A = (cv::Mat_<float>(9, 6) <<
-                 p1.x*p1.x, p1.x*p1.y, p1.y*p1.y, p1.x, p1.y, 1.f,
-                 p2.x*p2.x, p2.x*p2.y, p2.y*p2.y, p2.x, p2.y, 1.f,
-                 p3.x*p3.x, p3.x*p3.y, p3.y*p3.y, p3.x, p3.y, 1.f,
-                 p4.x*p4.x, p4.x*p4.y, p4.y*p4.y, p4.x, p4.y, 1.f,
-                 p5.x*p5.x, p5.x*p5.y, p5.y*p5.y, p5.x, p5.y, 1.f,
-                 p6.x*p6.x, p6.x*p6.y, p6.y*p6.y, p6.x, p6.y, 1.f,
-                 p7.x*p7.x, p7.x*p7.y, p7.y*p7.y, p7.x, p7.y, 1.f,
-                 p8.x*p8.x, p8.x*p8.y, p8.y*p8.y, p8.x, p8.y, 1.f,
-                 max_loc.x*max_loc.x, max_loc.x*max_loc.y, max_loc.y*max_loc.y, max_loc.x, max_loc.y, 1.f);
-    cv::Mat fval = (cv::Mat_<float>(9, 1) <<
-                    get_response_circular(p1, response),
-                    get_response_circular(p2, response),
-                    get_response_circular(p3, response),
-                    get_response_circular(p4, response),
-                    get_response_circular(p5, response),
-                    get_response_circular(p6, response),
-                    get_response_circular(p7, response),
-                    get_response_circular(p8, response),
-                    get_response_circular(max_loc, response));
-    // clang-format on
-    cv::Mat x;
-    cv::solve(A, fval, x, cv::DECOMP_SVD);
-
-    float a = x.at<float>(0), b = x.at<float>(1), c = x.at<float>(2), d = x.at<float>(3), e = x.at<float>(4);
+    // Least squares fit of the 2d quadratic function
+    //   f(u, v) = a*u^2 + b*u*v + c*v^2 + d*u + e*v + g
+    // to the 3x3 neighbourhood of max_loc (response is circular), where
+    // u, v are offsets from max_loc. On this grid the normal equations
+    // decouple, so the coefficients are simple weighted sums of f.
+    double s = 0, s_u = 0, s_v = 0, s_uu = 0, s_vv = 0, s_uv = 0;
+    for (int v = -1; v <= 1; ++v) {
+        for (int u = -1; u <= 1; ++u) {
+            cv::Point2i pt(max_loc.x + u, max_loc.y + v);
+            double f = get_response_circular(pt, response);
+            s += f;
+            s_u += u * f;
+            s_v += v * f;
+            s_uu += u * u * f;
+            s_vv += v * v * f;
+            s_uv += u * v * f;
+        }
+    }
+    double a_plus_c = (s_uu + s_vv) / 2. - 2. * s / 3.;
+    double a = (a_plus_c + (s_uu - s_vv) / 2.) / 2.;
+    double c = (a_plus_c - (s_uu - s_vv) / 2.) / 2.;
+    double b = s_uv / 4., d = s_u / 6., e = s_v / 6.;
 
     cv::Point2f sub_peak(max_loc.x, max_loc.y);
     if (b > 0 || b < 0) {
-        sub_peak.y = ((2.f * a * e) / b - d) / (b - (4 * a * c) / b);
-        sub_peak.x = (-2 * c * sub_peak.y - e) / b;
+        // stationary point of f
+        double det = 4. * a * c - b * b;
+        sub_peak.x += float((b * e - 2. * c * d) / det);
+        sub_peak.y += float((b * d - 2. * a * e) / det);
     }
 
     return sub_peak;
@@ -851,47 +1240,32 @@ cv::Point2f KCF_Tracker::sub_pixel_peak(cv::Point &max_loc, cv::Mat &response)
 
 double KCF_Tracker::sub_grid_scale(uint index)
 {
-    cv::Mat A, fval;
-    if (index >= p_scales.size()) {
-        // interpolate from all values
-        // fit 1d quadratic function f(x) = a*x^2 + b*x + c
-        A.create(p_scales.size(), 3, CV_32FC1);
-        fval.create(p_scales.size(), 1, CV_32FC1);
-        for (size_t i = 0; i < p_scales.size(); ++i) {
-            A.at<float>(i, 0) = float(p_scales[i] * p_scales[i]);
-            A.at<float>(i, 1) = float(p_scales[i]);
-            A.at<float>(i, 2) = 1;
-#ifdef BIG_BATCH
-            fval.at<float>(i) = p_threadctxs.back().max_responses[i];
-#else
-            fval.at<float>(i) = p_threadctxs[i].max_response;
-#endif
-        }
-    } else {
+    // fit 1d quadratic function f(x) = a*x^2 + b*x + c, the normal
+    // equations are accumulated and solved in fixed-size matrices
+    uint first = 0, last = uint(p_scales.size()) - 1;
+    if (index < p_scales.size()) {
         // only from neighbours
         if (index == 0 || index == p_scales.size() - 1)
            return p_scales[index];
-
-        A = (cv::Mat_<float>(3, 3) <<
-             p_scales[index - 1] * p_scales[index - 1], p_scales[index - 1], 1,
-             p_scales[index + 0] * p_scales[index + 0], p_scales[index + 0], 1,
-             p_scales[index + 1] * p_scales[index + 1], p_scales[index + 1], 1);
+        first = index - 1;
+        last = index + 1;
+    } // else interpolate from all values
+
+    cv::Matx33d AtA = cv::Matx33d::zeros();
+    cv::Vec3d Atf = cv::Vec3d::all(0);
+    for (uint i = first; i <= last; ++i) {
+        cv::Vec3d row(p_scales[i] * p_scales[i], p_scales[i], 1);
 #ifdef BIG_BATCH
-        fval = (cv::Mat_<float>(3, 1) <<
-                p_threadctxs.back().max_responses[index - 1],
-                p_threadctxs.back().max_responses[index + 0],
-                p_threadctxs.back().max_responses[index + 1]);
+        double fval = p_threadctxs.back().max_responses[i];
 #else
-        fval = (cv::Mat_<float>(3, 1) <<
-                p_threadctxs[index - 1].max_response,
-                p_threadctxs[index + 0].max_response,
-                p_threadctxs[index + 1].max_response);
+        double fval = p_threadctxs[i].max_response;
 #endif
+        AtA += row * row.t();
+        Atf += fval * row;
     }
 
-    cv::Mat x;
-    cv::solve(A, fval, x, cv::DECOMP_SVD);
-    float a = x.at<float>(0), b = x.at<float>(1);
+    cv::Matx31d x = AtA.solve(Atf, cv::DECOMP_LU);
+    double a = x(0), b = x(1);
     double scale = p_scales[index];
     if (a > 0 || a < 0)
         scale = -b / (2 * a);
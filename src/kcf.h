@@ -18,6 +18,7 @@
 #include "cnfeat.hpp"
 #include "fft.h"
 #include "threadctx.hpp"
+#include "threadpool.hpp"
 #include "pragmas.h"
 
 struct BBox_c
@@ -51,21 +52,55 @@ struct BBox_c
 
 };
 
+// Part of a (resized) frame, from which features are extracted
+struct FrameRegion
+{
+    cv::Mat rgb, gray;  // pixels of roi
+    cv::Rect roi;       // position in the (resized) frame
+    cv::Size size;      // size of the whole (resized) frame
+};
+
+// Whole frame converted once for several trackers (see MultiKCF)
+struct PreprocessedFrame
+{
+    FrameRegion full;   // not resized
+    FrameRegion half;   // resized by 1/2, empty if no tracker needs it
+};
+
 class KCF_Tracker
 {
 public:
     bool m_debug     {false};
     bool m_use_scale {true};
     bool m_use_color {true};
-#ifdef ASYNC
+    // run the scales in parallel (ASYNC and OPENMP builds)
+#if defined(ASYNC) || defined(OPENMP)
     bool m_use_multithreading {true};
 #else
     bool m_use_multithreading {false};
-#endif //ASYNC
+#endif //ASYNC || OPENMP
     bool m_use_subpixel_localization {true};
     bool m_use_subgrid_scale {true};
     bool m_use_cnfeat {true};
     bool m_use_linearkernel {false};
+    // Enlarge the window to sizes without prime factors larger than 7 (in
+    // feature cells), which are transformed faster
+    bool m_use_fft_friendly_size {false};
+    // Train on the features of the best detection scale, shifted to the new
+    // target position in the Fourier domain, instead of extracting them
+    // again. Larger shifts (in feature cells) fall back to the extraction.
+    // Not used with the feature pyramid, whose features are resampled.
+    bool m_reuse_detection_features {false};
+    double m_max_reuse_shift {2.};
+    // Compute the HOG features once per frame, on the window of the largest
+    // scale at the resolution of the smallest one, and resample the other
+    // scales from them (fast feature pyramid). The resampled channels are
+    // multiplied by (scale / smallest scale)^m_pyramid_lambda.
+    bool m_use_feature_pyramid {false};
+    double m_pyramid_lambda {0.1};
+    // FFT implementation, one of Fft::implementations(), "auto" for the
+    // fastest one for the window size or empty for the default one
+    std::string m_fft_implementation;
 #ifdef CUFFT
     bool m_use_cuda {true};
 #else
@@ -91,11 +126,29 @@ public:
 
     // frame-to-frame object tracking
     void track(cv::Mat & img);
+    // as above, taking the converted frame from frame where possible
+    void track(cv::Mat & img, const PreprocessedFrame & frame);
+    // track(img, frame) split in steps, so that the forward FFTs of several
+    // trackers can be executed together (see MultiKCF). trackFeatures()
+    // extracts the features of all scales, then the transforms listed by
+    // windowJobs() must be executed and trackUpdate() finishes the frame.
+    void trackFeatures(cv::Mat & img, const PreprocessedFrame & frame);
+    void windowJobs(std::vector<Fft::WindowJob> & jobs);
+    void trackUpdate(cv::Mat & img);
     BBox_c getBBox();
     double getFilterResponse() const; // Measure of tracking accuracy
+    bool isFrameDownscaled() const { return p_resize_image; }
+    const char *fftName() const { return p_fft->name(); }
+
+#ifdef ASYNC
+    // Workers running the scales in parallel, may be shared by several
+    // trackers that do not track at the same time. init() creates one if
+    // none is set.
+    void setThreadPool(std::shared_ptr<ThreadPool> pool) { p_pool = pool; }
+#endif
 
 private:
-    Fft &fft;
+    std::unique_ptr<Fft> p_fft;
 
     BBox_c p_pose;
     double max_response = -1.;
@@ -126,8 +179,43 @@ private:
     int p_num_of_feats;
     cv::Size p_roi;
 
+    // memory of all working buffers, must outlive them
+    Arena p_arena;
+
+    // what the buffers were allocated for by init()
+    struct Geometry {
+        cv::Size roi, img_size;
+        int img_type;
+        uint num_of_feats, num_of_scales;
+        bool linear_kernel;
+        std::string fft;
+        bool operator==(const Geometry &o) const
+        {
+            return roi == o.roi && img_size == o.img_size && img_type == o.img_type &&
+                   num_of_feats == o.num_of_feats && num_of_scales == o.num_of_scales &&
+                   linear_kernel == o.linear_kernel && fft == o.fft;
+        }
+    } p_geometry;
+
     std::vector<ThreadCtx> p_threadctxs;
 
+    // HOG channels resampled by get_features() with m_use_feature_pyramid
+    struct FeaturePyramid {
+        FeatureBuffers buf;
+        cv::Mat hog;    // row-major channels of roi.height rows each
+        cv::Size roi;
+    } p_pyramid;
+#ifdef ASYNC
+    std::shared_ptr<ThreadPool> p_pool;
+#endif
+
+    cv::Mat p_cos_window;
+
+    // region of the current frame prepared by preprocess_frame() and its storage
+    FrameRegion p_frame;
+    const PreprocessedFrame *p_shared_frame = nullptr;
+    cv::Mat p_frame_gray_u8, p_frame_gray, p_frame_gray_resized, p_frame_rgb_resized;
+
     //CUDA compability
     cv::Mat p_rot_labels;
     DynMem p_rot_labels_data;
@@ -140,16 +228,37 @@ private:
     ComplexMat p_model_xf;
     ComplexMat p_xf;
     //helping functions
-    void scale_track(ThreadCtx & vars, cv::Mat & input_rgb, cv::Mat & input_gray);
-    cv::Mat get_subwindow(const cv::Mat & input, int cx, int cy, int size_x, int size_y);
+    void select_fft();
+    void init_buffers();
+    void track_scales();
+    void track_update(cv::Mat & img);
+    void scale_track(ThreadCtx & vars, const FrameRegion & frame);
+    void scale_features(ThreadCtx & vars, const FrameRegion & frame);
+    void scale_response(ThreadCtx & vars);
+    cv::Rect feature_window(double scale) const;
+    cv::Rect search_region() const;
+    void preprocess_frame(const cv::Mat & img, cv::Rect region, bool init = false);
+    cv::Mat get_subwindow(const cv::Mat & input, const FrameRegion & frame, int cx, int cy, int size_x, int size_y,
+                          cv::Mat & buf);
     cv::Mat gaussian_shaped_labels(double sigma, int dim1, int dim2);
-    void gaussian_correlation(struct ThreadCtx &vars, const ComplexMat & xf, const ComplexMat & yf, double sigma, bool auto_correlation = false);
     cv::Mat circshift(const cv::Mat & patch, int x_rot, int y_rot);
     cv::Mat cosine_window_function(int dim1, int dim2);
-    std::vector<cv::Mat> get_features(cv::Mat & input_rgb, cv::Mat & input_gray, int cx, int cy, int size_x, int size_y, double scale = 1.);
+    void get_features(const FrameRegion & frame, int cx, int cy, int size_x, int size_y, double scale,
+                      FeatureBuffers & buf, cv::Mat & feats, bool from_pyramid = false);
+    bool use_feature_pyramid() const { return m_use_feature_pyramid && p_scales.size() > 1; }
+    void pyramid_features(const FrameRegion & frame);
+    void pyramid_hog(double scale, FeatureBuffers & buf, cv::Mat & feats);
     cv::Point2f sub_pixel_peak(cv::Point & max_loc, cv::Mat & response);
     double sub_grid_scale(uint index);
 
 };
 
+// Gaussian correlation of the spectra xf and yf (yf is ignored if
+// auto_correlation) transformed with fft. The kernel maps of the scales of
+// xf are left in vars.in_all, one below the other, and their spectra in
+// vars.kf if auto_correlation, otherwise in vars.kzf. It is a free
+// function, so that kcf_corrtest can check it.
+void gaussian_correlation(Fft & fft, ThreadCtx & vars, const ComplexMat & xf, const ComplexMat & yf, double sigma,
+                          bool auto_correlation = false);
+
 #endif //KCF_HEADER_6565467831231
@@ -0,0 +1,162 @@
+#include "multikcf.h"
+
+MultiKCF::MultiKCF(unsigned n_threads, bool pin_threads) : p_pool(std::max(1u, n_threads) - 1, pin_threads) {}
+
+size_t MultiKCF::addTarget(cv::Mat &img, const cv::Rect &bbox, int fit_size_x, int fit_size_y,
+                           const std::function<void(KCF_Tracker &)> &configure)
+{
+    std::unique_ptr<KCF_Tracker> tracker(new KCF_Tracker());
+    // the targets, not the scales, are tracked in parallel
+    tracker->m_use_multithreading = false;
+    if (configure)
+        configure(*tracker);
+    tracker->init(img, bbox, fit_size_x, fit_size_y);
+
+    if (p_fft_batch > 0) {
+        // create the FFT group of the windows now, the planning takes time
+        p_jobs.clear();
+        tracker->windowJobs(p_jobs);
+        for (const Fft::WindowJob &job : p_jobs)
+            fft_group(job, tracker->fftName()).jobs.reserve(p_trackers.size() * p_jobs.size() + p_jobs.size());
+    }
+
+    p_trackers.push_back(std::move(tracker));
+    p_results.push_back(Result{p_trackers.back()->getBBox(), p_trackers.back()->getFilterResponse()});
+    return p_trackers.size() - 1;
+}
+
+void MultiKCF::removeTarget(size_t i)
+{
+    p_trackers.erase(p_trackers.begin() + i);
+    p_results.erase(p_results.begin() + i);
+}
+
+// Prepares the whole-frame images needed by at least one tracker. The
+// threads of the pool convert horizontal bands of the frame.
+void MultiKCF::preprocess_frame(const cv::Mat &img)
+{
+    bool need_half = false;
+    for (const auto &tracker : p_trackers)
+        need_half |= tracker->isFrameDownscaled();
+
+    cv::Mat &gray = p_frame.full.gray;
+    gray.create(img.size(), CV_32FC1);
+    if (img.channels() == 3)
+        p_gray_u8.create(img.size(), CV_8UC1);
+    p_frame.full.rgb = img;
+    p_frame.full.roi = cv::Rect(cv::Point(0, 0), img.size());
+    p_frame.full.size = img.size();
+
+    if (need_half) {
+        // the size cv::resize() gives to a frame scaled by 0.5
+        cv::Size half_size(cvRound(img.cols * 0.5), cvRound(img.rows * 0.5));
+        p_frame.half.gray.create(half_size, CV_32FC1);
+        p_frame.half.rgb.create(half_size, img.type());
+        p_frame.half.size = half_size;
+        p_frame.half.roi = cv::Rect(cv::Point(0, 0), half_size);
+    } else {
+        p_frame.half = FrameRegion();
+    }
+
+    // The bands start at multiples of 4 rows, so that the 2x2 blocks of the
+    // INTER_AREA downscaling and the rounding of the size of the last band
+    // are the same as for the whole frame, and the result is identical to
+    // KCF_Tracker::preprocess_frame() with p_downscale_factor.
+    int units = (img.rows + 3) / 4;
+    auto convert = [&](unsigned t) {
+        int begin = std::min(img.rows, int(units * t / p_pool.size()) * 4);
+        int end = std::min(img.rows, int(units * (t + 1) / p_pool.size()) * 4);
+        if (begin >= end)
+            return;
+        cv::Mat src = img.rowRange(begin, end), dst = gray.rowRange(begin, end);
+        if (img.channels() == 3) {
+            cv::Mat u8 = p_gray_u8.rowRange(begin, end);
+            cv::cvtColor(src, u8, CV_BGR2GRAY);
+            u8.convertTo(dst, CV_32FC1);
+        } else
+            src.convertTo(dst, CV_32FC1);
+
+        if (need_half) {
+            int half_end = end == img.rows ? p_frame.half.size.height : end / 2;
+            cv::Mat half_gray = p_frame.half.gray.rowRange(begin / 2, half_end);
+            cv::Mat half_rgb = p_frame.half.rgb.rowRange(begin / 2, half_end);
+            cv::resize(dst, half_gray, cv::Size(0, 0), 0.5, 0.5, cv::INTER_AREA);
+            cv::resize(src, half_rgb, cv::Size(0, 0), 0.5, 0.5, cv::INTER_AREA);
+        }
+    };
+    p_pool.parallel_for(p_pool.size(), convert);
+}
+
+// Returns the FFT group of the windows of the same size and FFT implementation
+// as job, it is created if needed
+MultiKCF::FftGroup &MultiKCF::fft_group(const Fft::WindowJob &job, const std::string &fft_name)
+{
+    int rows = int(job.result->rows), cols = job.patch_feats->cols;
+    uint n_channels = job.result->n_channels;
+    for (FftGroup &group : p_fft_groups)
+        if (group.fft_name == fft_name && group.rows == rows && group.cols == cols && group.n_channels == n_channels)
+            return group;
+
+    p_fft_groups.push_back(
+        FftGroup{fft_name, rows, cols, n_channels, std::unique_ptr<Fft>(Fft::create(fft_name)), {}});
+    FftGroup &group = p_fft_groups.back();
+    group.fft->init(unsigned(cols), unsigned(rows), n_channels, 1);
+    group.fft->init_batch(p_fft_batch);
+    return group;
+}
+
+// Tracks the targets in three parallel steps, the forward FFTs of all
+// detection windows are executed in between, grouped by the window size
+void MultiKCF::track_batched(cv::Mat &img)
+{
+    auto features = [this, &img](unsigned i) { p_trackers[i]->trackFeatures(img, p_frame); };
+    p_pool.parallel_for(unsigned(p_trackers.size()), features);
+
+    for (FftGroup &group : p_fft_groups)
+        group.jobs.clear();
+    for (auto &tracker : p_trackers) {
+        p_jobs.clear();
+        tracker->windowJobs(p_jobs);
+        for (const Fft::WindowJob &job : p_jobs)
+            fft_group(job, tracker->fftName()).jobs.push_back(job);
+    }
+
+    // every thread transforms a part of each group, in whole batches
+    auto transform = [this](unsigned t) {
+        for (FftGroup &group : p_fft_groups) {
+            size_t n_batches = (group.jobs.size() + p_fft_batch - 1) / p_fft_batch;
+            size_t begin = std::min(group.jobs.size(), n_batches * t / p_pool.size() * p_fft_batch);
+            size_t end = std::min(group.jobs.size(), n_batches * (t + 1) / p_pool.size() * p_fft_batch);
+            if (begin < end)
+                group.fft->forward_window_batch(&group.jobs[begin], end - begin);
+        }
+    };
+    p_pool.parallel_for(p_pool.size(), transform);
+
+    auto update = [this, &img](unsigned i) {
+        KCF_Tracker &tracker = *p_trackers[i];
+        tracker.trackUpdate(img);
+        p_results[i].bbox = tracker.getBBox();
+        p_results[i].response = tracker.getFilterResponse();
+    };
+    p_pool.parallel_for(unsigned(p_trackers.size()), update);
+}
+
+const std::vector<MultiKCF::Result> &MultiKCF::track(cv::Mat &img)
+{
+    preprocess_frame(img);
+    if (p_fft_batch > 0) {
+        track_batched(img);
+        return p_results;
+    }
+
+    auto task = [this, &img](unsigned i) {
+        KCF_Tracker &tracker = *p_trackers[i];
+        tracker.track(img, p_frame);
+        p_results[i].bbox = tracker.getBBox();
+        p_results[i].response = tracker.getFilterResponse();
+    };
+    p_pool.parallel_for(unsigned(p_trackers.size()), task);
+
+    return p_results;
+}
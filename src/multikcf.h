@@ -0,0 +1,78 @@
+#ifndef MULTIKCF_HEADER
+#define MULTIKCF_HEADER
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kcf.h"
+#include "threadpool.hpp"
+
+// Tracks several targets in the same video. The frame is converted and
+// downscaled once for all of them, by all threads, and the targets are
+// tracked in parallel on a shared thread pool, each tracker running its
+// scales serially.
+class MultiKCF
+{
+public:
+    struct Result
+    {
+        BBox_c bbox;
+        double response;  // see KCF_Tracker::getFilterResponse()
+    };
+
+    // n_threads threads (including the caller of track()) track the targets.
+    // With pin_threads, each of them runs on its own CPU of the process
+    // (see ThreadPool).
+    explicit MultiKCF(unsigned n_threads = std::thread::hardware_concurrency(), bool pin_threads = false);
+
+    // Executes the forward FFTs of the detection windows of all targets
+    // with the same window size together, n_windows windows per FFT
+    // execution (see Fft::forward_window_batch). 0 turns batching off. It
+    // must be set before the targets are added.
+    void setFftBatch(unsigned n_windows) { p_fft_batch = n_windows; }
+
+    // Starts tracking a target in img, it is tracked from the next frame on.
+    // configure, if given, sets the options of its tracker before init().
+    // Returns the index of the target in results().
+    size_t addTarget(cv::Mat & img, const cv::Rect & bbox, int fit_size_x = -1, int fit_size_y = -1,
+                     const std::function<void(KCF_Tracker &)> & configure = nullptr);
+    // Stops tracking target i, the following targets move one index down
+    void removeTarget(size_t i);
+    size_t size() const { return p_trackers.size(); }
+    KCF_Tracker & tracker(size_t i) { return *p_trackers[i]; }
+
+    // Tracks all targets in img, the result of target i is at index i
+    const std::vector<Result> & track(cv::Mat & img);
+    const std::vector<Result> & results() const { return p_results; }
+
+private:
+    // transforms of the windows of one size
+    struct FftGroup
+    {
+        std::string fft_name;
+        int rows, cols;
+        uint n_channels;
+        std::unique_ptr<Fft> fft;
+        std::vector<Fft::WindowJob> jobs;
+    };
+
+    ThreadPool p_pool;
+    unsigned p_fft_batch = 0;
+    std::vector<FftGroup> p_fft_groups;
+    std::vector<Fft::WindowJob> p_jobs;
+
+    std::vector<std::unique_ptr<KCF_Tracker>> p_trackers;
+    std::vector<Result> p_results;
+
+    PreprocessedFrame p_frame;
+    cv::Mat p_gray_u8;
+
+    void preprocess_frame(const cv::Mat & img);
+    FftGroup & fft_group(const Fft::WindowJob & job, const std::string & fft_name);
+    void track_batched(cv::Mat & img);
+};
+
+#endif // MULTIKCF_HEADER
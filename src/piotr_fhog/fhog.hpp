@@ -8,6 +8,7 @@
 #define FHOG_HEADER_7813784354687
 
 #include <vector>
+#include <cassert>
 #include <opencv2/opencv.hpp>
 
 #include "gradientMex.h"
@@ -21,81 +22,116 @@ public:
     //return: computed descriptor
     static std::vector<cv::Mat> extract(const cv::Mat & img, int use_hog = 2, int bin_size = 4, int n_orients = 9, int soft_bin = -1, float clip = 0.2)
     {
-        // d image dimension -> gray image d = 1
-        // h, w -> height, width of image
-        // full -> ??
-        // I -> input image, M, O -> mag, orientation OUTPUT
-        int h = img.rows, w = img.cols, d = 1;
-        bool full = true;
+        int h = img.rows, w = img.cols;
         if (h < 2 || w < 2) {
             std::cerr << "I must be at least 2x2." << std::endl;
             return std::vector<cv::Mat>();
         }
+        std::vector<cv::Mat> res(num_channels(use_hog, n_orients));
+        extract(img, res.data(), use_hog, bin_size, n_orients, soft_bin, clip);
+        return res;
+    }
 
-//        //image rows-by-rows
-//        float * I = new float[h*w];
-//        for (int y = 0; y < h; ++y) {
-//            const float * row_ptr = img.ptr<float>(y);
-//            for (int x = 0; x < w; ++x) {
-//                I[y*w + x] = row_ptr[x];
-//            }
-//        }
+    //description: number of channels returned by extract()
+    static int num_channels(int use_hog = 2, int n_orients = 9)
+    {
+        int n_chns = (use_hog == 0) ? n_orients : (use_hog==1 ? n_orients*4 : n_orients*3+5);
+        return (use_hog == 2) ? n_chns-1 : n_chns;    //last channel all zeros for fhog
+    }
 
-        //image cols-by-cols
-        float * I = new float[h*w];
-        for (int x = 0; x < w; ++x) {
-            for (int y = 0; y < h; ++y) {
-                I[x*h + y] = img.at<float>(y, x)/255.f;
-            }
+    //description: same as above, but the descriptor is written to num_channels()
+    //matrices starting at res, which are reused if they already have the right
+    //size. The working memory is kept between calls (per thread), so that
+    //repeated extraction does not allocate.
+    static void extract(const cv::Mat & img, cv::Mat * res, int use_hog = 2, int bin_size = 4, int n_orients = 9, int soft_bin = -1, float clip = 0.2)
+    {
+        // h, w -> height, width of image
+        // full -> ??
+        // M, O -> mag, orientation OUTPUT
+        int h = img.rows, w = img.cols;
+        bool full = true;
+        if (h < 2 || w < 2) {
+            std::cerr << "I must be at least 2x2." << std::endl;
+            return;
         }
 
-        float *M = new float[h*w], *O = new float[h*w];
-        gradMag(I, M, O, h, w, d, full);
+        static thread_local std::vector<float> M, O, H;
+        gradient(img, M, O);
 
         int n_chns = (use_hog == 0) ? n_orients : (use_hog==1 ? n_orients*4 : n_orients*3+5);
         int hb = h/bin_size, wb = w/bin_size;
 
-        float *H = new float[hb*wb*n_chns];
-        memset(H, 0, hb*wb*n_chns*sizeof(float));
+        H.assign(hb*wb*n_chns, 0.f);
 
         if (use_hog == 0) {
             full = false;   //by default
-            gradHist( M, O, H, h, w, bin_size, n_orients, soft_bin, full );
+            gradHist( M.data(), O.data(), H.data(), h, w, bin_size, n_orients, soft_bin, full );
         } else if (use_hog == 1) {
             full = false;   //by default
-            hog( M, O, H, h, w, bin_size, n_orients, soft_bin, full, clip );
+            hog( M.data(), O.data(), H.data(), h, w, bin_size, n_orients, soft_bin, full, clip );
         } else {
-            fhog( M, O, H, h, w, bin_size, n_orients, soft_bin, clip );
+            fhog( M.data(), O.data(), H.data(), h, w, bin_size, n_orients, soft_bin, clip );
         }
 
         //convert, assuming row-by-row-by-channel storage
-        std::vector<cv::Mat> res;
-        int n_res_channels = (use_hog == 2) ? n_chns-1 : n_chns;    //last channel all zeros for fhog
-        res.reserve(n_res_channels);
+        int n_res_channels = num_channels(use_hog, n_orients);
         for (int i = 0; i < n_res_channels; ++i) {
             //output rows-by-rows
 //            cv::Mat desc(hb, wb, CV_32F, (H+hb*wb*i));
 
             //output cols-by-cols
-            cv::Mat desc(hb, wb, CV_32F);
+            cv::Mat &desc = res[i];
+            desc.create(hb, wb, CV_32F);
             for (int x = 0; x < wb; ++x) {
                 for (int y = 0; y < hb; ++y) {
                     desc.at<float>(y,x) = H[i*hb*wb + x*hb + y];
                 }
             }
-
-            res.push_back(desc.clone());
         }
+    }
 
-        //clean
-        delete [] I;
-        delete [] M;
-        delete [] O;
-        delete [] H;
+    //description: fhog (use_hog == 2) written directly to a caller-owned
+    //buffer, e.g. the input of the forward FFT. Channel i of the descriptor
+    //is stored row-major at dst + i*chn_stride with rows row_stride floats
+    //apart, multiplied by window (bin-sized cells, CV_32F) if not empty.
+    static void extract(const cv::Mat & img, float * dst, int row_stride, int chn_stride, const cv::Mat & window,
+                        int bin_size = 4, int n_orients = 9, int soft_bin = -1, float clip = 0.2)
+    {
+        int h = img.rows, w = img.cols;
+        if (h < 2 || w < 2) {
+            std::cerr << "I must be at least 2x2." << std::endl;
+            return;
+        }
+        assert(window.empty() || (window.rows == h / bin_size && window.cols == w / bin_size &&
+                                  window.type() == CV_32F && window.isContinuous()));
 
-        return res;
+        static thread_local std::vector<float> M, O;
+        gradient(img, M, O);
+        fhogRowMajor(M.data(), O.data(), dst, h, w, bin_size, n_orients, soft_bin, clip,
+                     window.empty() ? nullptr : window.ptr<float>(), row_stride, chn_stride);
     }
 
+private:
+    //gradient magnitude and orientation of img (column-major, as expected by the piotr code)
+    static void gradient(const cv::Mat & img, std::vector<float> & M, std::vector<float> & O)
+    {
+        // d image dimension -> gray image d = 1
+        int h = img.rows, w = img.cols, d = 1;
+        bool full = true;
+        static thread_local std::vector<float> I;
+
+        //image cols-by-cols
+        I.resize(h*w);
+        for (int x = 0; x < w; ++x) {
+            for (int y = 0; y < h; ++y) {
+                I[x*h + y] = img.at<float>(y, x)/255.f;
+            }
+        }
+
+        M.resize(h*w);
+        O.resize(h*w);
+        gradMag(I.data(), M.data(), O.data(), h, w, d, full);
+    }
 };
 
 #endif //FHOG_HEADER_7813784354687
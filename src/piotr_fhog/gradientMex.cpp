@@ -9,32 +9,41 @@
 #include "string.h"
 
 #include "sse.hpp"
+#include "gradient_simd.h"
 
 #define PI 3.14159265f
 
-// compute x and y gradients for just one column (uses sse)
+// Temporary buffers. Outside of Matlab these are per-thread buffers that
+// are kept between calls (one per slot), so that repeated feature
+// extraction does not allocate memory once the buffers have grown.
+enum { TMP_GRAD_M2, TMP_GRAD_GX, TMP_GRAD_GY, TMP_HIST_O0, TMP_HIST_O1, TMP_HIST_M0,
+  TMP_HIST_M1, TMP_NORM_N, TMP_HOG_R1, TMP_HOG_R2, TMP_SLOTS };
+#ifdef MATLAB_MEX_FILE
+static void* tmpAlloc( int slot, size_t size ) { (void) slot; return alMalloc(size,16); }
+static void* tmpCalloc( int slot, size_t num, size_t size ) { (void) slot; return wrCalloc(num,size); }
+static void tmpFree( void* ptr, bool aligned ) { if(aligned) alFree(ptr); else wrFree(ptr); }
+#else
+struct TmpBuf { void *p; size_t n; TmpBuf() : p(0), n(0) {} ~TmpBuf() { if(p) alFree(p); } };
+static void* tmpAlloc( int slot, size_t size ) {
+  static thread_local TmpBuf buf[TMP_SLOTS]; TmpBuf &b=buf[slot];
+  if( size>b.n ) { if(b.p) alFree(b.p); b.p=alMalloc(size,16); b.n=size; }
+  return b.p;
+}
+static void* tmpCalloc( int slot, size_t num, size_t size ) {
+  void *p=tmpAlloc(slot,num*size); memset(p,0,num*size); return p;
+}
+static void tmpFree( void* ptr, bool aligned ) { (void) ptr; (void) aligned; }
+#endif
+
+// compute x and y gradients for just one column (see gradient_simd.h)
 void grad1( float *I, float *Gx, float *Gy, int h, int w, int x ) {
-  int y, y1; float *Ip, *In, r; __m128 *_Ip, *_In, *_G, _r;
+  const GradientKernels &k=gradient_kernels(); float *Ip, *In, r;
   // compute column of Gx
   Ip=I-h; In=I+h; r=.5f;
   if(x==0) { r=1; Ip+=h; } else if(x==w-1) { r=1; In-=h; }
-  if( h<4 || h%4>0 || (size_t(I)&15) || (size_t(Gx)&15) ) {
-    for( y=0; y<h; y++ ) *Gx++=(*In++-*Ip++)*r;
-  } else {
-    _G=(__m128*) Gx; _Ip=(__m128*) Ip; _In=(__m128*) In; _r = SET(r);
-    for(y=0; y<h; y+=4) *_G++=MUL(SUB(*_In++,*_Ip++),_r);
-  }
+  k.grad_x(Gx,In,Ip,r,h);
   // compute column of Gy
-  #define GRADY(r) *Gy++=(*In++-*Ip++)*r;
-  Ip=I; In=Ip+1;
-  // GRADY(1); Ip--; for(y=1; y<h-1; y++) GRADY(.5f); In--; GRADY(1);
-  y1=((~((size_t) Gy) + 1) & 15)/4; if(y1==0) y1=4; if(y1>h-1) y1=h-1;
-  GRADY(1); Ip--; for(y=1; y<y1; y++) GRADY(.5f);
-  _r = SET(.5f); _G=(__m128*) Gy;
-  for(; y+4<h-1; y+=4, Ip+=4, In+=4, Gy+=4)
-    *_G++=MUL(SUB(LDu(*In),LDu(*Ip)),_r);
-  for(; y<h-1; y++) GRADY(.5f); In--; GRADY(1);
-  #undef GRADY
+  k.grad_y(Gy,I,h);
 }
 
 // compute x and y gradients at each location (uses sse)
@@ -58,47 +67,24 @@ float* acosTable() {
 
 // compute gradient magnitude and orientation at each location (uses sse)
 void gradMag( float *I, float *M, float *O, int h, int w, int d, bool full ) {
-  int x, y, y1, c, h4, s; float *Gx, *Gy, *M2; __m128 *_Gx, *_Gy, *_M2, _m;
+  int x, c, h4, s; float *Gx, *Gy, *M2; const GradientKernels &k=gradient_kernels();
   float *acost = acosTable(), acMult=10000.0f;
-  // allocate memory for storing one column of output (padded so h4%4==0)
-  h4=(h%4==0) ? h : h-(h%4)+4; s=d*h4*sizeof(float);
-  M2=(float*) alMalloc(s,16); _M2=(__m128*) M2;
-  Gx=(float*) alMalloc(s,16); _Gx=(__m128*) Gx;
-  Gy=(float*) alMalloc(s,16); _Gy=(__m128*) Gy;
+  // allocate memory for storing one column of output (padded to full vectors)
+  h4=(h+GRADIENT_SIMD_PAD-1)/GRADIENT_SIMD_PAD*GRADIENT_SIMD_PAD; s=d*h4*sizeof(float);
+  M2=(float*) tmpAlloc(TMP_GRAD_M2,s);
+  Gx=(float*) tmpAlloc(TMP_GRAD_GX,s);
+  Gy=(float*) tmpAlloc(TMP_GRAD_GY,s);
   // compute gradient magnitude and orientation for each column
   for( x=0; x<w; x++ ) {
     // compute gradients (Gx, Gy) with maximum squared magnitude (M2)
     for(c=0; c<d; c++) {
       grad1( I+x*h+c*w*h, Gx+c*h4, Gy+c*h4, h, w, x );
-      for( y=0; y<h4/4; y++ ) {
-        y1=h4/4*c+y;
-        _M2[y1]=ADD(MUL(_Gx[y1],_Gx[y1]),MUL(_Gy[y1],_Gy[y1]));
-        if( c==0 ) continue;
-        _m = CMPGT( _M2[y1], _M2[y] );
-        _M2[y] = OR( AND(_m,_M2[y1]), ANDNOT(_m,_M2[y]) );
-        _Gx[y] = OR( AND(_m,_Gx[y1]), ANDNOT(_m,_Gx[y]) );
-        _Gy[y] = OR( AND(_m,_Gy[y1]), ANDNOT(_m,_Gy[y]) );
-      }
-    }
-    // compute gradient mangitude (M) and normalize Gx
-    for( y=0; y<h4/4; y++ ) {
-      _m = MIN( RCPSQRT(_M2[y]), SET(1e10f) );
-      _M2[y] = RCP(_m);
-      if(O) _Gx[y] = MUL( MUL(_Gx[y],_m), SET(acMult) );
-      if(O) _Gx[y] = XOR( _Gx[y], AND(_Gy[y], SET(-0.f)) );
-    };
-    memcpy( M+x*h, M2, h*sizeof(float) );
-    // compute and store gradient orientation (O) via table lookup
-    if( O!=0 ) for( y=0; y<h; y++ ) O[x*h+y] = acost[(int)Gx[y]];
-    if( O!=0 && full ) {
-      y1=((~size_t(O+x*h)+1)&15)/4; y=0;
-      for( ; y<y1; y++ ) O[y+x*h]+=(Gy[y]<0)*PI;
-      for( ; y<h-4; y+=4 ) STRu( O[y+x*h],
-        ADD( LDu(O[y+x*h]), AND(CMPLT(LDu(Gy[y]),SET(0.f)),SET(PI)) ) );
-      for( ; y<h; y++ ) O[y+x*h]+=(Gy[y]<0)*PI;
+      k.grad_max( M2, Gx, Gy, Gx+c*h4, Gy+c*h4, h, c==0 );
     }
+    // compute gradient mangitude (M) and orientation (O) via table lookup
+    k.mag_orient( M+x*h, O ? O+x*h : 0, M2, Gx, Gy, h, acost, acMult, full );
   }
-  alFree(Gx); alFree(Gy); alFree(M2);
+  tmpFree(Gx,true); tmpFree(Gy,true); tmpFree(M2,true);
 }
 
 // normalize gradient magnitude at each location (uses sse)
@@ -113,40 +99,11 @@ void gradMagNorm( float *M, float *S, int h, int w, float norm ) {
   for(; i<n; i++) M[i] /= (S[i] + norm);
 }
 
-// helper for gradHist, quantize O and M into O0, O1 and M0, M1 (uses sse)
+// helper for gradHist, quantize O and M into O0, O1 and M0, M1 (see gradient_simd.h)
 void gradQuantize( float *O, float *M, int *O0, int *O1, float *M0, float *M1,
   int nb, int n, float norm, int nOrients, bool full, bool interpolate )
 {
-  // assumes all *OUTPUT* matrices are 4-byte aligned
-  int i, o0, o1; float o, od, m;
-  __m128i _o0, _o1, *_O0, *_O1; __m128 _o, _od, _m, *_M0, *_M1;
-  // define useful constants
-  const float oMult=(float)nOrients/(full?2*PI:PI); const int oMax=nOrients*nb;
-  const __m128 _norm=SET(norm), _oMult=SET(oMult), _nbf=SET((float)nb);
-  const __m128i _oMax=SET(oMax), _nb=SET(nb);
-  // perform the majority of the work with sse
-  _O0=(__m128i*) O0; _O1=(__m128i*) O1; _M0=(__m128*) M0; _M1=(__m128*) M1;
-  if( interpolate ) for( i=0; i<=n-4; i+=4 ) {
-    _o=MUL(LDu(O[i]),_oMult); _o0=CVT(_o); _od=SUB(_o,CVT(_o0));
-    _o0=CVT(MUL(CVT(_o0),_nbf)); _o0=AND(CMPGT(_oMax,_o0),_o0); *_O0++=_o0;
-    _o1=ADD(_o0,_nb); _o1=AND(CMPGT(_oMax,_o1),_o1); *_O1++=_o1;
-    _m=MUL(LDu(M[i]),_norm); *_M1=MUL(_od,_m); *_M0++=SUB(_m,*_M1); _M1++;
-  } else for( i=0; i<=n-4; i+=4 ) {
-    _o=MUL(LDu(O[i]),_oMult); _o0=CVT(ADD(_o,SET(.5f)));
-    _o0=CVT(MUL(CVT(_o0),_nbf)); _o0=AND(CMPGT(_oMax,_o0),_o0); *_O0++=_o0;
-    *_M0++=MUL(LDu(M[i]),_norm); *_M1++=SET(0.f); *_O1++=SET(0);
-  }
-  // compute trailing locations without sse
-  if( interpolate ) for(; i<n; i++ ) {
-    o=O[i]*oMult; o0=(int) o; od=o-o0;
-    o0*=nb; if(o0>=oMax) o0=0; O0[i]=o0;
-    o1=o0+nb; if(o1==oMax) o1=0; O1[i]=o1;
-    m=M[i]*norm; M1[i]=od*m; M0[i]=m-M1[i];
-  } else for(; i<n; i++ ) {
-    o=O[i]*oMult; o0=(int) (o+.5f);
-    o0*=nb; if(o0>=oMax) o0=0; O0[i]=o0;
-    M0[i]=M[i]*norm; M1[i]=0; O1[i]=0;
-  }
+  gradient_kernels().quantize(O,M,O0,O1,M0,M1,nb,n,norm,nOrients,full,interpolate);
 }
 
 // compute nOrients gradient histograms per bin x bin block of pixels
@@ -156,8 +113,8 @@ void gradHist( float *M, float *O, float *H, int h, int w,
   const int hb=h/bin, wb=w/bin, h0=hb*bin, w0=wb*bin, nb=wb*hb;
   const float s=(float)bin, sInv=1/s, sInv2=1/s/s;
   float *H0, *H1, *M0, *M1; int x, y; int *O0, *O1; float xb, init;
-  O0=(int*)alMalloc(h*sizeof(int),16); M0=(float*) alMalloc(h*sizeof(float),16);
-  O1=(int*)alMalloc(h*sizeof(int),16); M1=(float*) alMalloc(h*sizeof(float),16);
+  O0=(int*)tmpAlloc(TMP_HIST_O0,h*sizeof(int)); M0=(float*) tmpAlloc(TMP_HIST_M0,h*sizeof(float));
+  O1=(int*)tmpAlloc(TMP_HIST_O1,h*sizeof(int)); M1=(float*) tmpAlloc(TMP_HIST_M1,h*sizeof(float));
   // main loop
   for( x=0; x<w0; x++ ) {
     // compute target orientation bins for entire column - very fast
@@ -225,7 +182,7 @@ void gradHist( float *M, float *O, float *H, int h, int w,
       #undef GH
     }
   }
-  alFree(O0); alFree(O1); alFree(M0); alFree(M1);
+  tmpFree(O0,true); tmpFree(O1,true); tmpFree(M0,true); tmpFree(M1,true);
   // normalize boundary bins which only get 7/8 of weight of interior bins
   if( softBin%2!=0 ) for( int o=0; o<nOrients; o++ ) {
     x=0; for( y=0; y<hb; y++ ) H[o*nb+x*hb+y]*=8.f/7.f;
@@ -241,7 +198,7 @@ void gradHist( float *M, float *O, float *H, int h, int w,
 float* hogNormMatrix( float *H, int nOrients, int hb, int wb, int bin ) {
   float *N, *N1, *n; int o, x, y, dx, dy, hb1=hb+1, wb1=wb+1;
   float eps = 1e-4f/4/bin/bin/bin/bin; // precise backward equality
-  N = (float*) wrCalloc(hb1*wb1,sizeof(float)); N1=N+hb1+1;
+  N = (float*) tmpCalloc(TMP_NORM_N,hb1*wb1,sizeof(float)); N1=N+hb1+1;
   for( o=0; o<nOrients; o++ ) for( x=0; x<wb; x++ ) for( y=0; y<hb; y++ )
     N1[x*hb1+y] += H[o*wb*hb+x*hb+y]*H[o*wb*hb+x*hb+y];
   for( x=0; x<wb-1; x++ ) for( y=0; y<hb-1; y++ ) {
@@ -291,13 +248,13 @@ void hog( float *M, float *O, float *H, int h, int w, int binSize,
   float *N, *R; const int hb=h/binSize, wb=w/binSize, nb=hb*wb;
   (void) nb;
   // compute unnormalized gradient histograms
-  R = (float*) wrCalloc(wb*hb*nOrients,sizeof(float));
+  R = (float*) tmpCalloc(TMP_HOG_R1,wb*hb*nOrients,sizeof(float));
   gradHist( M, O, R, h, w, binSize, nOrients, softBin, full );
   // compute block normalization values
   N = hogNormMatrix( R, nOrients, hb, wb, binSize );
   // perform four normalizations per spatial block
   hogChannels( H, R, N, hb, wb, nOrients, clip, 0 );
-  wrFree(N); wrFree(R);
+  tmpFree(N,false); tmpFree(R,false);
 }
 
 // compute FHOG features
@@ -307,10 +264,10 @@ void fhog( float *M, float *O, float *H, int h, int w, int binSize,
   const int hb=h/binSize, wb=w/binSize, nb=hb*wb, nbo=nb*nOrients;
   float *N, *R1, *R2; int o, x;
   // compute unnormalized constrast sensitive histograms
-  R1 = (float*) wrCalloc(wb*hb*nOrients*2 + 2,sizeof(float));
+  R1 = (float*) tmpCalloc(TMP_HOG_R1,wb*hb*nOrients*2 + 2,sizeof(float));
   gradHist( M, O, R1, h, w, binSize, nOrients*2, softBin, true );
   // compute unnormalized contrast insensitive histograms
-  R2 = (float*) wrCalloc(wb*hb*nOrients,sizeof(float));
+  R2 = (float*) tmpCalloc(TMP_HOG_R2,wb*hb*nOrients,sizeof(float));
   for( o=0; o<nOrients; o++ ) for( x=0; x<nb; x++ )
     R2[o*nb+x] = R1[o*nb+x]+R1[(o+nOrients)*nb+x];
   // compute block normalization values
@@ -319,7 +276,48 @@ void fhog( float *M, float *O, float *H, int h, int w, int binSize,
   hogChannels( H+nbo*0, R1, N, hb, wb, nOrients*2, clip, 1 );
   hogChannels( H+nbo*2, R2, N, hb, wb, nOrients*1, clip, 1 );
   hogChannels( H+nbo*3, R1, N, hb, wb, nOrients*2, clip, 2 );
-  wrFree(N); wrFree(R1); wrFree(R2);
+  tmpFree(N,false); tmpFree(R1,false); tmpFree(R2,false);
+}
+
+// same as fhog, but the (nOrients*3+4) channels are written in row-major
+// order, each multiplied by window (hb x wb, row-major, may be NULL):
+// channel c of cell (y,x) is stored at H[c*chnStride+y*rowStride+x].
+// Each output value is computed in registers and written exactly once.
+void fhogRowMajor( float *M, float *O, float *H, int h, int w, int binSize,
+  int nOrients, int softBin, float clip, const float *window,
+  int rowStride, int chnStride )
+{
+  const int hb=h/binSize, wb=w/binSize, nb=hb*wb, hb1=hb+1;
+  const float r=.2357f; float *N, *R1, *R2; int o, x, y, c;
+  // compute unnormalized constrast sensitive histograms
+  R1 = (float*) tmpCalloc(TMP_HOG_R1,wb*hb*nOrients*2 + 2,sizeof(float));
+  gradHist( M, O, R1, h, w, binSize, nOrients*2, softBin, true );
+  // compute unnormalized contrast insensitive histograms
+  R2 = (float*) tmpCalloc(TMP_HOG_R2,wb*hb*nOrients,sizeof(float));
+  for( o=0; o<nOrients; o++ ) for( x=0; x<nb; x++ )
+    R2[o*nb+x] = R1[o*nb+x]+R1[(o+nOrients)*nb+x];
+  // compute block normalization values
+  N = hogNormMatrix( R2, nOrients, hb, wb, binSize );
+  // normalized histograms and texture channels (see hogChannels)
+  for( y=0; y<hb; y++ ) for( x=0; x<wb; x++ ) {
+    const float *N1=N+x*hb1+hb1+1+y;
+    const float n[4] = { N1[0], N1[-1], N1[-hb1], N1[-hb1-1] };
+    const float wgt = window ? window[y*wb+x] : 1.f;
+    float *H1=H+y*rowStride+x, tex[4]={0,0,0,0}, t, s;
+    for( o=0; o<nOrients*2; o++ ) {
+      const float R=R1[o*nb+x*hb+y]; s=0;
+      for( c=0; c<4; c++ ) {
+        t=R*n[c]; if(t>clip) t=clip; s+=t*.5f; tex[c]+=t*r; }
+      H1[o*chnStride]=s*wgt;
+    }
+    for( o=0; o<nOrients; o++ ) {
+      const float R=R2[o*nb+x*hb+y]; s=0;
+      for( c=0; c<4; c++ ) { t=R*n[c]; if(t>clip) t=clip; s+=t*.5f; }
+      H1[(nOrients*2+o)*chnStride]=s*wgt;
+    }
+    for( c=0; c<4; c++ ) H1[(nOrients*3+c)*chnStride]=tex[c]*wgt;
+  }
+  tmpFree(N,false); tmpFree(R1,false); tmpFree(R2,false);
 }
 
 /******************************************************************************/
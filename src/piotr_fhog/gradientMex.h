@@ -8,5 +8,8 @@ void hog( float *M, float *O, float *H, int h, int w, int binSize,
         int nOrients, int softBin, bool full, float clip );
 void fhog( float *M, float *O, float *H, int h, int w, int binSize,
         int nOrients, int softBin, float clip );
+void fhogRowMajor( float *M, float *O, float *H, int h, int w, int binSize,
+        int nOrients, int softBin, float clip, const float *window,
+        int rowStride, int chnStride );
 
 #endif //GRADIENTMEX_HEADER_233244546834240
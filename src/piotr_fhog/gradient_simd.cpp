@@ -0,0 +1,478 @@
+#include "gradient_simd.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "simd_limit.h"
+#include "sse.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+// GCC reports the deliberately undefined pass-through operands of the
+// AVX-512 intrinsics when they are used from target() functions
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+static const float pi = 3.14159265f;
+
+// ****************************************************************************
+// SSE, the kernels of the original toolbox, 4 floats per vector. With
+// SSE2NEON, they are also used on ARM.
+
+static void grad_x_sse(float *Gx, const float *In, const float *Ip, float r, int h)
+{
+    const __m128 _r = SET(r);
+    int y = 0;
+    for (; y + 4 <= h; y += 4)
+        STRu(Gx[y], MUL(SUB(LDu(In[y]), LDu(Ip[y])), _r));
+    for (; y < h; y++)
+        Gx[y] = (In[y] - Ip[y]) * r;
+}
+
+static void grad_y_sse(float *Gy, const float *I, int h)
+{
+    const __m128 _half = SET(.5f);
+    Gy[0] = I[1] - I[0];
+    int y = 1;
+    for (; y + 4 <= h - 1; y += 4)
+        STRu(Gy[y], MUL(SUB(LDu(I[y + 1]), LDu(I[y - 1])), _half));
+    for (; y < h - 1; y++)
+        Gy[y] = (I[y + 1] - I[y - 1]) * .5f;
+    Gy[h - 1] = I[h - 1] - I[h - 2];
+}
+
+static void grad_max_sse(float *M2, float *Gx, float *Gy, const float *gx, const float *gy, int n, bool first)
+{
+    for (int y = 0; y < n; y += 4) {
+        __m128 _x = LDu(gx[y]), _y = LDu(gy[y]);
+        __m128 _m2 = ADD(MUL(_x, _x), MUL(_y, _y));
+        if (first) {
+            STRu(M2[y], _m2);
+            continue;
+        }
+        __m128 _m = CMPGT(_m2, LDu(M2[y]));
+        STRu(M2[y], OR(AND(_m, _m2), ANDNOT(_m, LDu(M2[y]))));
+        STRu(Gx[y], OR(AND(_m, _x), ANDNOT(_m, LDu(Gx[y]))));
+        STRu(Gy[y], OR(AND(_m, _y), ANDNOT(_m, LDu(Gy[y]))));
+    }
+}
+
+static void mag_orient_sse(float *M, float *O, const float *M2, const float *Gx, const float *Gy, int n,
+                           const float *acost, float ac_mult, bool full)
+{
+    const __m128 _big = SET(1e10f), _mult = SET(ac_mult), _sign = SET(-0.f), _zero = SET(0.f), _pi = SET(pi);
+    for (int y = 0; y < n; y += 4) {
+        const int k = std::min(4, n - y);
+        float m4[4], o4[4];
+        int i4[4];
+        __m128 _m = MIN(RCPSQRT(LDu(M2[y])), _big);
+        STRu(m4[0], RCP(_m));
+        memcpy(M + y, m4, k * sizeof(float));
+        if (!O)
+            continue;
+        // the table index is Gx / M scaled, with the sign of Gy
+        __m128 _g = MUL(MUL(LDu(Gx[y]), _m), _mult);
+        _g = XOR(_g, AND(LDu(Gy[y]), _sign));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(i4), CVT(_g));
+        for (int j = 0; j < k; j++)
+            o4[j] = acost[i4[j]];
+        if (full)
+            STRu(o4[0], ADD(LDu(o4[0]), AND(CMPLT(LDu(Gy[y]), _zero), _pi)));
+        memcpy(O + y, o4, k * sizeof(float));
+    }
+}
+
+static void quantize_sse(const float *O, const float *M, int *O0, int *O1, float *M0, float *M1, int nb, int n,
+                         float norm, int nOrients, bool full, bool interpolate)
+{
+    int i, o0, o1;
+    float o, od, m;
+    __m128i _o0, _o1, *_O0, *_O1;
+    __m128 _o, _od, _m, *_M0, *_M1;
+    // define useful constants
+    const float oMult = (float)nOrients / (full ? 2 * pi : pi);
+    const int oMax = nOrients * nb;
+    const __m128 _norm = SET(norm), _oMult = SET(oMult), _nbf = SET((float)nb);
+    const __m128i _oMax = SET(oMax), _nb = SET(nb);
+    // perform the majority of the work with sse
+    _O0 = (__m128i *)O0;
+    _O1 = (__m128i *)O1;
+    _M0 = (__m128 *)M0;
+    _M1 = (__m128 *)M1;
+    if (interpolate)
+        for (i = 0; i <= n - 4; i += 4) {
+            _o = MUL(LDu(O[i]), _oMult);
+            _o0 = CVT(_o);
+            _od = SUB(_o, CVT(_o0));
+            _o0 = CVT(MUL(CVT(_o0), _nbf));
+            _o0 = AND(CMPGT(_oMax, _o0), _o0);
+            *_O0++ = _o0;
+            _o1 = ADD(_o0, _nb);
+            _o1 = AND(CMPGT(_oMax, _o1), _o1);
+            *_O1++ = _o1;
+            _m = MUL(LDu(M[i]), _norm);
+            *_M1 = MUL(_od, _m);
+            *_M0++ = SUB(_m, *_M1);
+            _M1++;
+        }
+    else
+        for (i = 0; i <= n - 4; i += 4) {
+            _o = MUL(LDu(O[i]), _oMult);
+            _o0 = CVT(ADD(_o, SET(.5f)));
+            _o0 = CVT(MUL(CVT(_o0), _nbf));
+            _o0 = AND(CMPGT(_oMax, _o0), _o0);
+            *_O0++ = _o0;
+            *_M0++ = MUL(LDu(M[i]), _norm);
+            *_M1++ = SET(0.f);
+            *_O1++ = SET(0);
+        }
+    // compute trailing locations without sse
+    if (interpolate)
+        for (; i < n; i++) {
+            o = O[i] * oMult;
+            o0 = (int)o;
+            od = o - o0;
+            o0 *= nb;
+            if (o0 >= oMax) o0 = 0;
+            O0[i] = o0;
+            o1 = o0 + nb;
+            if (o1 == oMax) o1 = 0;
+            O1[i] = o1;
+            m = M[i] * norm;
+            M1[i] = od * m;
+            M0[i] = m - M1[i];
+        }
+    else
+        for (; i < n; i++) {
+            o = O[i] * oMult;
+            o0 = (int)(o + .5f);
+            o0 *= nb;
+            if (o0 >= oMax) o0 = 0;
+            O0[i] = o0;
+            M0[i] = M[i] * norm;
+            M1[i] = 0;
+            O1[i] = 0;
+        }
+}
+
+static const GradientKernels kernels_sse = {
+    "SSE",
+    grad_x_sse,
+    grad_y_sse,
+    grad_max_sse,
+    mag_orient_sse,
+    quantize_sse,
+};
+
+#ifdef SIMD_X86
+
+// ****************************************************************************
+// AVX2, 8 floats per vector, the ends of the columns are handled with
+// masked loads and stores. Like the AVX-512 kernels, they compute exactly
+// what the SSE kernels do, without FMA (the library is compiled with
+// -ffp-contract=off), so the features do not depend on the CPU.
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+// lanes below n set
+AVX2_FN static inline __m256i tail_mask_avx2(int n)
+{
+    static const int ones[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ones + 8 - std::min(n, 8)));
+}
+
+AVX2_FN static void grad_x_avx2(float *Gx, const float *In, const float *Ip, float r, int h)
+{
+    const __m256 vr = _mm256_set1_ps(r);
+    for (int y = 0; y < h; y += 8) {
+        __m256i m = tail_mask_avx2(h - y);
+        __m256 d = _mm256_sub_ps(_mm256_maskload_ps(In + y, m), _mm256_maskload_ps(Ip + y, m));
+        _mm256_maskstore_ps(Gx + y, m, _mm256_mul_ps(d, vr));
+    }
+}
+
+AVX2_FN static void grad_y_avx2(float *Gy, const float *I, int h)
+{
+    const __m256 half = _mm256_set1_ps(.5f);
+    Gy[0] = I[1] - I[0];
+    for (int y = 1; y < h - 1; y += 8) {
+        __m256i m = tail_mask_avx2(h - 1 - y);
+        __m256 d = _mm256_sub_ps(_mm256_maskload_ps(I + y + 1, m), _mm256_maskload_ps(I + y - 1, m));
+        _mm256_maskstore_ps(Gy + y, m, _mm256_mul_ps(d, half));
+    }
+    Gy[h - 1] = I[h - 1] - I[h - 2];
+}
+
+AVX2_FN static void grad_max_avx2(float *M2, float *Gx, float *Gy, const float *gx, const float *gy, int n, bool first)
+{
+    for (int y = 0; y < n; y += 8) {
+        __m256 vx = _mm256_loadu_ps(gx + y), vy = _mm256_loadu_ps(gy + y);
+        __m256 m2 = _mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy));
+        if (first) {
+            _mm256_storeu_ps(M2 + y, m2);
+            continue;
+        }
+        __m256 old = _mm256_loadu_ps(M2 + y);
+        __m256 gt = _mm256_cmp_ps(m2, old, _CMP_GT_OQ);
+        _mm256_storeu_ps(M2 + y, _mm256_blendv_ps(old, m2, gt));
+        _mm256_storeu_ps(Gx + y, _mm256_blendv_ps(_mm256_loadu_ps(Gx + y), vx, gt));
+        _mm256_storeu_ps(Gy + y, _mm256_blendv_ps(_mm256_loadu_ps(Gy + y), vy, gt));
+    }
+}
+
+AVX2_FN static void mag_orient_avx2(float *M, float *O, const float *M2, const float *Gx, const float *Gy, int n,
+                                    const float *acost, float ac_mult, bool full)
+{
+    const __m256 big = _mm256_set1_ps(1e10f), mult = _mm256_set1_ps(ac_mult), sign = _mm256_set1_ps(-0.f);
+    const __m256 zero = _mm256_setzero_ps(), vpi = _mm256_set1_ps(pi);
+    for (int y = 0; y < n; y += 8) {
+        __m256i mask = tail_mask_avx2(n - y);
+        __m256 m = _mm256_min_ps(_mm256_rsqrt_ps(_mm256_loadu_ps(M2 + y)), big);
+        _mm256_maskstore_ps(M + y, mask, _mm256_rcp_ps(m));
+        if (!O)
+            continue;
+        __m256 gy = _mm256_loadu_ps(Gy + y);
+        __m256 g = _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(Gx + y), m), mult);
+        g = _mm256_xor_ps(g, _mm256_and_ps(gy, sign));
+        __m256 o = _mm256_mask_i32gather_ps(zero, acost, _mm256_cvttps_epi32(g), _mm256_castsi256_ps(mask), 4);
+        if (full)
+            o = _mm256_add_ps(o, _mm256_and_ps(_mm256_cmp_ps(gy, zero, _CMP_LT_OQ), vpi));
+        _mm256_maskstore_ps(O + y, mask, o);
+    }
+}
+
+AVX2_FN static void quantize_avx2(const float *O, const float *M, int *O0, int *O1, float *M0, float *M1, int nb,
+                                  int n, float norm, int nOrients, bool full, bool interpolate)
+{
+    const __m256 vnorm = _mm256_set1_ps(norm), mult = _mm256_set1_ps((float)nOrients / (full ? 2 * pi : pi));
+    const __m256i vmax = _mm256_set1_epi32(nOrients * nb), vnb = _mm256_set1_epi32(nb);
+    for (int i = 0; i < n; i += 8) {
+        __m256i mask = tail_mask_avx2(n - i);
+        __m256 o = _mm256_mul_ps(_mm256_maskload_ps(O + i, mask), mult);
+        __m256 m = _mm256_mul_ps(_mm256_maskload_ps(M + i, mask), vnorm);
+        __m256i o0, o1;
+        __m256 m0, m1;
+        if (interpolate) {
+            o0 = _mm256_cvttps_epi32(o);
+            __m256 od = _mm256_sub_ps(o, _mm256_cvtepi32_ps(o0));
+            o0 = _mm256_mullo_epi32(o0, vnb);
+            o0 = _mm256_and_si256(_mm256_cmpgt_epi32(vmax, o0), o0);
+            o1 = _mm256_add_epi32(o0, vnb);
+            o1 = _mm256_and_si256(_mm256_cmpgt_epi32(vmax, o1), o1);
+            m1 = _mm256_mul_ps(od, m);
+            m0 = _mm256_sub_ps(m, m1);
+        } else {
+            o0 = _mm256_cvttps_epi32(_mm256_add_ps(o, _mm256_set1_ps(.5f)));
+            o0 = _mm256_mullo_epi32(o0, vnb);
+            o0 = _mm256_and_si256(_mm256_cmpgt_epi32(vmax, o0), o0);
+            o1 = _mm256_setzero_si256();
+            m0 = m;
+            m1 = _mm256_setzero_ps();
+        }
+        _mm256_maskstore_epi32(O0 + i, mask, o0);
+        _mm256_maskstore_epi32(O1 + i, mask, o1);
+        _mm256_maskstore_ps(M0 + i, mask, m0);
+        _mm256_maskstore_ps(M1 + i, mask, m1);
+    }
+}
+
+static const GradientKernels kernels_avx2 = {
+    "AVX2",
+    grad_x_avx2,
+    grad_y_avx2,
+    grad_max_avx2,
+    mag_orient_avx2,
+    quantize_avx2,
+};
+
+// ****************************************************************************
+// AVX-512, 16 floats per vector, the ends of the columns are handled with
+// masks
+
+#define AVX512_FN __attribute__((target("avx512f")))
+
+AVX512_FN static inline __mmask16 tail_mask_avx512(int n)
+{
+    return n >= 16 ? __mmask16(0xffff) : __mmask16((1u << n) - 1);
+}
+
+AVX512_FN static void grad_x_avx512(float *Gx, const float *In, const float *Ip, float r, int h)
+{
+    const __m512 vr = _mm512_set1_ps(r);
+    for (int y = 0; y < h; y += 16) {
+        __mmask16 m = tail_mask_avx512(h - y);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, In + y), _mm512_maskz_loadu_ps(m, Ip + y));
+        _mm512_mask_storeu_ps(Gx + y, m, _mm512_mul_ps(d, vr));
+    }
+}
+
+AVX512_FN static void grad_y_avx512(float *Gy, const float *I, int h)
+{
+    const __m512 half = _mm512_set1_ps(.5f);
+    Gy[0] = I[1] - I[0];
+    for (int y = 1; y < h - 1; y += 16) {
+        __mmask16 m = tail_mask_avx512(h - 1 - y);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, I + y + 1), _mm512_maskz_loadu_ps(m, I + y - 1));
+        _mm512_mask_storeu_ps(Gy + y, m, _mm512_mul_ps(d, half));
+    }
+    Gy[h - 1] = I[h - 1] - I[h - 2];
+}
+
+AVX512_FN static void grad_max_avx512(float *M2, float *Gx, float *Gy, const float *gx, const float *gy, int n,
+                                      bool first)
+{
+    for (int y = 0; y < n; y += 16) {
+        __m512 vx = _mm512_loadu_ps(gx + y), vy = _mm512_loadu_ps(gy + y);
+        __m512 m2 = _mm512_add_ps(_mm512_mul_ps(vx, vx), _mm512_mul_ps(vy, vy));
+        if (first) {
+            _mm512_storeu_ps(M2 + y, m2);
+            continue;
+        }
+        __mmask16 gt = _mm512_cmp_ps_mask(m2, _mm512_loadu_ps(M2 + y), _CMP_GT_OQ);
+        _mm512_mask_storeu_ps(M2 + y, gt, m2);
+        _mm512_mask_storeu_ps(Gx + y, gt, vx);
+        _mm512_mask_storeu_ps(Gy + y, gt, vy);
+    }
+}
+
+// _mm256_rsqrt_ps() and _mm256_rcp_ps() of both halves of x. They give the
+// same results as the SSE approximations, the more precise ones of AVX-512
+// (rsqrt14, rcp14) move the orientations of some pixels to other bins.
+AVX512_FN static inline __m512 rsqrt_like_sse(__m512 x)
+{
+    __m256d lo = _mm256_castps_pd(_mm256_rsqrt_ps(_mm512_castps512_ps256(x)));
+    __m256d hi = _mm256_castps_pd(_mm256_rsqrt_ps(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1))));
+    return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(lo), hi, 1));
+}
+
+AVX512_FN static inline __m512 rcp_like_sse(__m512 x)
+{
+    __m256d lo = _mm256_castps_pd(_mm256_rcp_ps(_mm512_castps512_ps256(x)));
+    __m256d hi = _mm256_castps_pd(_mm256_rcp_ps(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1))));
+    return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(lo), hi, 1));
+}
+
+AVX512_FN static void mag_orient_avx512(float *M, float *O, const float *M2, const float *Gx, const float *Gy, int n,
+                                        const float *acost, float ac_mult, bool full)
+{
+    const __m512 big = _mm512_set1_ps(1e10f), mult = _mm512_set1_ps(ac_mult), zero = _mm512_setzero_ps();
+    const __m512 vpi = _mm512_set1_ps(pi);
+    const __m512i sign = _mm512_castps_si512(_mm512_set1_ps(-0.f));
+    for (int y = 0; y < n; y += 16) {
+        __mmask16 mask = tail_mask_avx512(n - y);
+        __m512 m = _mm512_min_ps(rsqrt_like_sse(_mm512_loadu_ps(M2 + y)), big);
+        _mm512_mask_storeu_ps(M + y, mask, rcp_like_sse(m));
+        if (!O)
+            continue;
+        __m512 gy = _mm512_loadu_ps(Gy + y);
+        __m512 g = _mm512_mul_ps(_mm512_mul_ps(_mm512_loadu_ps(Gx + y), m), mult);
+        g = _mm512_castsi512_ps(
+            _mm512_xor_si512(_mm512_castps_si512(g), _mm512_and_si512(_mm512_castps_si512(gy), sign)));
+        __m512 o = _mm512_mask_i32gather_ps(zero, mask, _mm512_cvttps_epi32(g), acost, 4);
+        if (full)
+            o = _mm512_mask_add_ps(o, _mm512_cmp_ps_mask(gy, zero, _CMP_LT_OQ), o, vpi);
+        _mm512_mask_storeu_ps(O + y, mask, o);
+    }
+}
+
+AVX512_FN static void quantize_avx512(const float *O, const float *M, int *O0, int *O1, float *M0, float *M1, int nb,
+                                      int n, float norm, int nOrients, bool full, bool interpolate)
+{
+    const __m512 vnorm = _mm512_set1_ps(norm), mult = _mm512_set1_ps((float)nOrients / (full ? 2 * pi : pi));
+    const __m512i vmax = _mm512_set1_epi32(nOrients * nb), vnb = _mm512_set1_epi32(nb);
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 mask = tail_mask_avx512(n - i);
+        __m512 o = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, O + i), mult);
+        __m512 m = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, M + i), vnorm);
+        __m512i o0, o1;
+        __m512 m0, m1;
+        if (interpolate) {
+            o0 = _mm512_cvttps_epi32(o);
+            __m512 od = _mm512_sub_ps(o, _mm512_cvtepi32_ps(o0));
+            o0 = _mm512_mullo_epi32(o0, vnb);
+            o0 = _mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(vmax, o0), o0);
+            o1 = _mm512_add_epi32(o0, vnb);
+            o1 = _mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(vmax, o1), o1);
+            m1 = _mm512_mul_ps(od, m);
+            m0 = _mm512_sub_ps(m, m1);
+        } else {
+            o0 = _mm512_cvttps_epi32(_mm512_add_ps(o, _mm512_set1_ps(.5f)));
+            o0 = _mm512_mullo_epi32(o0, vnb);
+            o0 = _mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(vmax, o0), o0);
+            o1 = _mm512_setzero_si512();
+            m0 = m;
+            m1 = _mm512_setzero_ps();
+        }
+        _mm512_mask_storeu_epi32(O0 + i, mask, o0);
+        _mm512_mask_storeu_epi32(O1 + i, mask, o1);
+        _mm512_mask_storeu_ps(M0 + i, mask, m0);
+        _mm512_mask_storeu_ps(M1 + i, mask, m1);
+    }
+}
+
+static const GradientKernels kernels_avx512 = {
+    "AVX-512",
+    grad_x_avx512,
+    grad_y_avx512,
+    grad_max_avx512,
+    mag_orient_avx512,
+    quantize_avx512,
+};
+
+#endif // SIMD_X86
+
+std::vector<const GradientKernels *> gradient_kernels_supported()
+{
+    std::vector<const GradientKernels *> kernels = {&kernels_sse};
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(&kernels_avx2);
+    if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back(&kernels_avx512);
+#endif
+    return kernels;
+}
+
+static const GradientKernels *select_kernels(const std::string &limit)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    // AVX2 and AVX-512 only on request, on the short columns of the
+    // typical windows they are not faster than SSE
+    if (limit == "avx512" && __builtin_cpu_supports("avx512f"))
+        return &kernels_avx512;
+    if ((limit == "avx512" || limit == "avx2") && __builtin_cpu_supports("avx2"))
+        return &kernels_avx2;
+#endif
+    return &kernels_sse;
+}
+
+static const GradientKernels *select_kernels()
+{
+    bool unknown;
+    const GradientKernels *kernels = select_kernels(simd_limit(unknown));
+    if (unknown)
+        simd_limit_warning("gradient kernels", kernels->name);
+    return kernels;
+}
+
+static const GradientKernels *&current_kernels()
+{
+    static const GradientKernels *kernels = select_kernels();
+    return kernels;
+}
+
+const GradientKernels &gradient_kernels()
+{
+    return *current_kernels();
+}
+
+void set_gradient_kernels(const GradientKernels &kernels)
+{
+    current_kernels() = &kernels;
+}
@@ -0,0 +1,44 @@
+#ifndef GRADIENT_SIMD_H
+#define GRADIENT_SIMD_H
+
+#include <vector>
+
+// Column kernels of gradMag() and gradHist() (see gradientMex.cpp). SSE is
+// used by default, as the AVX2 and AVX-512 versions are not faster on the
+// short columns of the typical windows. The KCF_SIMD environment variable
+// of simd_kernels.h selects them with avx2 or avx512, if the CPU supports
+// them. All of them compute the same features, the AVX2 and AVX-512
+// versions handle the ends of the columns with masked loads and stores.
+struct GradientKernels {
+    const char *name;
+
+    // Gx[y] = (In[y] - Ip[y]) * r for y < h
+    void (*grad_x)(float *Gx, const float *In, const float *Ip, float r, int h);
+    // Gy[y] = (I[y + 1] - I[y - 1]) / 2, one-sided differences at y = 0
+    // and y = h - 1 (h >= 2)
+    void (*grad_y)(float *Gy, const float *I, int h);
+    // M2 = gx^2 + gy^2 if first, otherwise M2, Gx and Gy take the values of
+    // gx, gy where their squared magnitude is larger. All arrays have
+    // n rounded up to GRADIENT_SIMD_PAD elements.
+    void (*grad_max)(float *M2, float *Gx, float *Gy, const float *gx, const float *gy, int n, bool first);
+    // M = sqrt(M2) and, if O is not null, the orientation of (Gx, Gy) in
+    // [0, pi), or [0, 2 pi) if full, looked up in acost (acost[x * ac_mult]
+    // ~= acos(x)). M2, Gx and Gy are padded as in grad_max.
+    void (*mag_orient)(float *M, float *O, const float *M2, const float *Gx, const float *Gy, int n,
+                       const float *acost, float ac_mult, bool full);
+    // see gradQuantize()
+    void (*quantize)(const float *O, const float *M, int *O0, int *O1, float *M0, float *M1, int nb, int n,
+                     float norm, int nOrients, bool full, bool interpolate);
+};
+
+// Padding of the column buffers passed to grad_max and mag_orient, in floats
+#define GRADIENT_SIMD_PAD 16
+
+const GradientKernels &gradient_kernels();
+// Implementations supported by the CPU (regardless of KCF_SIMD), SSE first
+std::vector<const GradientKernels *> gradient_kernels_supported();
+// Use kernels from now on, e.g. to compare the implementations. Not
+// thread-safe, the features must not be computed at the same time.
+void set_gradient_kernels(const GradientKernels &kernels);
+
+#endif // GRADIENT_SIMD_H
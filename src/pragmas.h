@@ -18,4 +18,13 @@
 #define NORMAL_OMP_CRITICAL
 #endif
 
+// The next loop has no dependencies between its iterations, vectorize it
+#if defined(__clang__)
+#define VECTORIZED_LOOP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define VECTORIZED_LOOP _Pragma("GCC ivdep")
+#else
+#define VECTORIZED_LOOP
+#endif
+
 #endif // PRAGMAS_H
@@ -0,0 +1,474 @@
+#include "simd_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include "simd_limit.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+// GCC reports the deliberately undefined pass-through operands of the
+// AVX-512 intrinsics when they are used from target() functions
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// ****************************************************************************
+// Portable implementation, also used for the tails of the vectorised loops
+
+template <bool acc, bool conj> static void cmul_scalar(float *dst, const float *a, const float *b, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; i += 2) {
+        float b_im = conj ? -b[i + 1] : b[i + 1];
+        float re = a[i] * b[i] - a[i + 1] * b_im;
+        float im = a[i] * b_im + a[i + 1] * b[i];
+        if (acc) {
+            dst[i] += re;
+            dst[i + 1] += im;
+        } else {
+            dst[i] = re;
+            dst[i + 1] = im;
+        }
+    }
+}
+
+static void cdiv_scalar(float *dst, const float *a, const float *b, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; i += 2) {
+        float inv = 1.f / (b[i] * b[i] + b[i + 1] * b[i + 1]);
+        float re = (a[i] * b[i] + a[i + 1] * b[i + 1]) * inv;
+        float im = (a[i + 1] * b[i] - a[i] * b[i + 1]) * inv;
+        dst[i] = re;
+        dst[i + 1] = im;
+    }
+}
+
+static void axpby_scalar(float *dst, float alpha, const float *x, float beta, const float *y, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; ++i)
+        dst[i] = alpha * x[i] + beta * y[i];
+}
+
+static void accumulate_scalar(float *dst, const float *a, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; ++i)
+        dst[i] += a[i];
+}
+
+static float sqr_norm_scalar(const float *a, size_t n)
+{
+    float sum = 0;
+    for (size_t i = 0; i < 2 * n; ++i)
+        sum += a[i] * a[i];
+    return sum;
+}
+
+static void gaussian_exp_scalar(float *dst, const float *src, size_t src_stride, size_t n, float c0, float c1)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = std::exp(std::min(c0 + c1 * src[i * src_stride], 0.f));
+}
+
+// Constants of the Cephes expf() approximation: exp(x) = 2^k * p(r),
+// where k = round(x * log2(e)) and r = x - k * ln(2).
+static const float exp_lo = -87.33654f;
+static const float exp_log2e = 1.44269504088896341f;
+static const float exp_ln2_hi = 0.693359375f;
+static const float exp_ln2_lo = -2.12194440e-4f;
+static const float exp_p[] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                              4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+static const SimdKernels kernels_scalar = {
+    "scalar",
+    cmul_scalar<false, false>,
+    cmul_scalar<true, false>,
+    cmul_scalar<false, true>,
+    cmul_scalar<true, true>,
+    cdiv_scalar,
+    axpby_scalar,
+    accumulate_scalar,
+    sqr_norm_scalar,
+    gaussian_exp_scalar,
+};
+
+#ifdef SIMD_X86
+
+// ****************************************************************************
+// SSE3, 2 complex numbers per vector
+
+#define SSE3_FN __attribute__((target("sse3")))
+
+SSE3_FN static inline __m128 cmul_sse3(__m128 a, __m128 b, bool conj)
+{
+    __m128 b_re = _mm_moveldup_ps(b), b_im = _mm_movehdup_ps(b);
+    __m128 a_sw = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 t = _mm_mul_ps(a_sw, b_im);
+    if (conj) t = _mm_sub_ps(_mm_setzero_ps(), t);
+    return _mm_addsub_ps(_mm_mul_ps(a, b_re), t);
+}
+
+template <bool acc, bool conj> SSE3_FN static void cmul_sse3(float *dst, const float *a, const float *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128 r = cmul_sse3(_mm_loadu_ps(a + 2 * i), _mm_loadu_ps(b + 2 * i), conj);
+        if (acc) r = _mm_add_ps(r, _mm_loadu_ps(dst + 2 * i));
+        _mm_storeu_ps(dst + 2 * i, r);
+    }
+    cmul_scalar<acc, conj>(dst + 2 * i, a + 2 * i, b + 2 * i, n - i);
+}
+
+SSE3_FN static void cdiv_sse3(float *dst, const float *a, const float *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128 vb = _mm_loadu_ps(b + 2 * i);
+        __m128 sq = _mm_mul_ps(vb, vb);
+        __m128 mag = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(dst + 2 * i, _mm_div_ps(cmul_sse3(_mm_loadu_ps(a + 2 * i), vb, true), mag));
+    }
+    cdiv_scalar(dst + 2 * i, a + 2 * i, b + 2 * i, n - i);
+}
+
+SSE3_FN static void axpby_sse3(float *dst, float alpha, const float *x, float beta, const float *y, size_t n)
+{
+    __m128 va = _mm_set1_ps(alpha), vb = _mm_set1_ps(beta);
+    size_t i = 0;
+    for (; i + 4 <= 2 * n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(x + i)), _mm_mul_ps(vb, _mm_loadu_ps(y + i))));
+    for (; i < 2 * n; ++i)
+        dst[i] = alpha * x[i] + beta * y[i];
+}
+
+SSE3_FN static void accumulate_sse3(float *dst, const float *a, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= 2 * n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(a + i)));
+    for (; i < 2 * n; ++i)
+        dst[i] += a[i];
+}
+
+SSE3_FN static float sqr_norm_sse3(const float *a, size_t n)
+{
+    __m128 sum = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= 2 * n; i += 4) {
+        __m128 v = _mm_loadu_ps(a + i);
+        sum = _mm_add_ps(sum, _mm_mul_ps(v, v));
+    }
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    float res = _mm_cvtss_f32(sum);
+    for (; i < 2 * n; ++i)
+        res += a[i] * a[i];
+    return res;
+}
+
+// x must be <= 0
+SSE3_FN static inline __m128 exp_sse3(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(exp_lo));
+    __m128i k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(exp_log2e)));
+    __m128 fk = _mm_cvtepi32_ps(k);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(fk, _mm_set1_ps(exp_ln2_hi)));
+    r = _mm_sub_ps(r, _mm_mul_ps(fk, _mm_set1_ps(exp_ln2_lo)));
+    __m128 p = _mm_set1_ps(exp_p[0]);
+    for (int j = 1; j < 6; ++j)
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p[j]));
+    p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), r), _mm_set1_ps(1.f));
+    __m128i pow2k = _mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(pow2k));
+}
+
+SSE3_FN static void gaussian_exp_sse3(float *dst, const float *src, size_t src_stride, size_t n, float c0, float c1)
+{
+    __m128 v0 = _mm_set1_ps(c0), v1 = _mm_set1_ps(c1);
+    const size_t s = src_stride;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p = src + i * s;
+        __m128 v = s == 1 ? _mm_loadu_ps(p) : _mm_set_ps(p[3 * s], p[2 * s], p[s], p[0]);
+        v = _mm_min_ps(_mm_add_ps(v0, _mm_mul_ps(v1, v)), _mm_setzero_ps());
+        _mm_storeu_ps(dst + i, exp_sse3(v));
+    }
+    gaussian_exp_scalar(dst + i, src + i * s, s, n - i, c0, c1);
+}
+
+static const SimdKernels kernels_sse3 = {
+    "SSE3",
+    cmul_sse3<false, false>,
+    cmul_sse3<true, false>,
+    cmul_sse3<false, true>,
+    cmul_sse3<true, true>,
+    cdiv_sse3,
+    axpby_sse3,
+    accumulate_sse3,
+    sqr_norm_sse3,
+    gaussian_exp_sse3,
+};
+
+// ****************************************************************************
+// AVX2 + FMA, 4 complex numbers per vector
+
+#define AVX2_FN __attribute__((target("avx2,fma")))
+
+AVX2_FN static inline __m256 cmul_avx2(__m256 a, __m256 b, bool conj)
+{
+    __m256 b_re = _mm256_moveldup_ps(b), b_im = _mm256_movehdup_ps(b);
+    __m256 a_sw = _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+    __m256 t = _mm256_mul_ps(a_sw, b_im);
+    return conj ? _mm256_fmsubadd_ps(a, b_re, t) : _mm256_fmaddsub_ps(a, b_re, t);
+}
+
+template <bool acc, bool conj> AVX2_FN static void cmul_avx2(float *dst, const float *a, const float *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256 r = cmul_avx2(_mm256_loadu_ps(a + 2 * i), _mm256_loadu_ps(b + 2 * i), conj);
+        if (acc) r = _mm256_add_ps(r, _mm256_loadu_ps(dst + 2 * i));
+        _mm256_storeu_ps(dst + 2 * i, r);
+    }
+    cmul_scalar<acc, conj>(dst + 2 * i, a + 2 * i, b + 2 * i, n - i);
+}
+
+AVX2_FN static void cdiv_avx2(float *dst, const float *a, const float *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256 vb = _mm256_loadu_ps(b + 2 * i);
+        __m256 sq = _mm256_mul_ps(vb, vb);
+        __m256 mag = _mm256_add_ps(sq, _mm256_permute_ps(sq, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm256_storeu_ps(dst + 2 * i, _mm256_div_ps(cmul_avx2(_mm256_loadu_ps(a + 2 * i), vb, true), mag));
+    }
+    cdiv_scalar(dst + 2 * i, a + 2 * i, b + 2 * i, n - i);
+}
+
+AVX2_FN static void axpby_avx2(float *dst, float alpha, const float *x, float beta, const float *y, size_t n)
+{
+    __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+    size_t i = 0;
+    for (; i + 8 <= 2 * n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_mul_ps(vb, _mm256_loadu_ps(y + i))));
+    for (; i < 2 * n; ++i)
+        dst[i] = alpha * x[i] + beta * y[i];
+}
+
+AVX2_FN static void accumulate_avx2(float *dst, const float *a, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= 2 * n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(a + i)));
+    for (; i < 2 * n; ++i)
+        dst[i] += a[i];
+}
+
+AVX2_FN static float sqr_norm_avx2(const float *a, size_t n)
+{
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= 2 * n; i += 8) {
+        __m256 v = _mm256_loadu_ps(a + i);
+        sum = _mm256_fmadd_ps(v, v, sum);
+    }
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    float res = _mm_cvtss_f32(s);
+    for (; i < 2 * n; ++i)
+        res += a[i] * a[i];
+    return res;
+}
+
+// x must be <= 0
+AVX2_FN static inline __m256 exp_avx2(__m256 x)
+{
+    x = _mm256_max_ps(x, _mm256_set1_ps(exp_lo));
+    __m256i k = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(exp_log2e)));
+    __m256 fk = _mm256_cvtepi32_ps(k);
+    __m256 r = _mm256_fnmadd_ps(fk, _mm256_set1_ps(exp_ln2_hi), x);
+    r = _mm256_fnmadd_ps(fk, _mm256_set1_ps(exp_ln2_lo), r);
+    __m256 p = _mm256_set1_ps(exp_p[0]);
+    for (int j = 1; j < 6; ++j)
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p[j]));
+    p = _mm256_add_ps(_mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r), _mm256_set1_ps(1.f));
+    __m256i pow2k = _mm256_slli_epi32(_mm256_add_epi32(k, _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(pow2k));
+}
+
+AVX2_FN static void gaussian_exp_avx2(float *dst, const float *src, size_t src_stride, size_t n, float c0, float c1)
+{
+    __m256 v0 = _mm256_set1_ps(c0), v1 = _mm256_set1_ps(c1);
+    __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(int(src_stride)));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float *p = src + i * src_stride;
+        __m256 v = src_stride == 1 ? _mm256_loadu_ps(p) : _mm256_i32gather_ps(p, idx, 4);
+        v = _mm256_min_ps(_mm256_fmadd_ps(v1, v, v0), _mm256_setzero_ps());
+        _mm256_storeu_ps(dst + i, exp_avx2(v));
+    }
+    gaussian_exp_scalar(dst + i, src + i * src_stride, src_stride, n - i, c0, c1);
+}
+
+static const SimdKernels kernels_avx2 = {
+    "AVX2",
+    cmul_avx2<false, false>,
+    cmul_avx2<true, false>,
+    cmul_avx2<false, true>,
+    cmul_avx2<true, true>,
+    cdiv_avx2,
+    axpby_avx2,
+    accumulate_avx2,
+    sqr_norm_avx2,
+    gaussian_exp_avx2,
+};
+
+// ****************************************************************************
+// AVX-512, 8 complex numbers per vector, tails are handled with masks
+
+#define AVX512_FN __attribute__((target("avx512f")))
+
+AVX512_FN static inline __mmask16 tail_mask_avx512(size_t floats)
+{
+    return __mmask16((1u << floats) - 1);
+}
+
+AVX512_FN static inline __m512 cmul_avx512(__m512 a, __m512 b, bool conj)
+{
+    __m512 b_re = _mm512_moveldup_ps(b), b_im = _mm512_movehdup_ps(b);
+    __m512 a_sw = _mm512_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+    __m512 t = _mm512_mul_ps(a_sw, b_im);
+    return conj ? _mm512_fmsubadd_ps(a, b_re, t) : _mm512_fmaddsub_ps(a, b_re, t);
+}
+
+template <bool acc, bool conj>
+AVX512_FN static void cmul_avx512(float *dst, const float *a, const float *b, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; i += 16) {
+        __mmask16 m = 2 * n - i >= 16 ? __mmask16(0xffff) : tail_mask_avx512(2 * n - i);
+        __m512 r = cmul_avx512(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), conj);
+        if (acc) r = _mm512_add_ps(r, _mm512_maskz_loadu_ps(m, dst + i));
+        _mm512_mask_storeu_ps(dst + i, m, r);
+    }
+}
+
+AVX512_FN static void cdiv_avx512(float *dst, const float *a, const float *b, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; i += 16) {
+        __mmask16 m = 2 * n - i >= 16 ? __mmask16(0xffff) : tail_mask_avx512(2 * n - i);
+        __m512 vb = _mm512_mask_loadu_ps(_mm512_set1_ps(1.f), m, b + i);
+        __m512 sq = _mm512_mul_ps(vb, vb);
+        __m512 mag = _mm512_add_ps(sq, _mm512_permute_ps(sq, _MM_SHUFFLE(2, 3, 0, 1)));
+        __m512 r = _mm512_div_ps(cmul_avx512(_mm512_maskz_loadu_ps(m, a + i), vb, true), mag);
+        _mm512_mask_storeu_ps(dst + i, m, r);
+    }
+}
+
+AVX512_FN static void axpby_avx512(float *dst, float alpha, const float *x, float beta, const float *y, size_t n)
+{
+    __m512 va = _mm512_set1_ps(alpha), vb = _mm512_set1_ps(beta);
+    for (size_t i = 0; i < 2 * n; i += 16) {
+        __mmask16 m = 2 * n - i >= 16 ? __mmask16(0xffff) : tail_mask_avx512(2 * n - i);
+        __m512 r = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i), _mm512_mul_ps(vb, _mm512_maskz_loadu_ps(m, y + i)));
+        _mm512_mask_storeu_ps(dst + i, m, r);
+    }
+}
+
+AVX512_FN static void accumulate_avx512(float *dst, const float *a, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; i += 16) {
+        __mmask16 m = 2 * n - i >= 16 ? __mmask16(0xffff) : tail_mask_avx512(2 * n - i);
+        _mm512_mask_storeu_ps(dst + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, dst + i), _mm512_maskz_loadu_ps(m, a + i)));
+    }
+}
+
+AVX512_FN static float sqr_norm_avx512(const float *a, size_t n)
+{
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < 2 * n; i += 16) {
+        __mmask16 m = 2 * n - i >= 16 ? __mmask16(0xffff) : tail_mask_avx512(2 * n - i);
+        __m512 v = _mm512_maskz_loadu_ps(m, a + i);
+        sum = _mm512_fmadd_ps(v, v, sum);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+// x must be <= 0
+AVX512_FN static inline __m512 exp_avx512(__m512 x)
+{
+    x = _mm512_max_ps(x, _mm512_set1_ps(exp_lo));
+    __m512i k = _mm512_cvtps_epi32(_mm512_mul_ps(x, _mm512_set1_ps(exp_log2e)));
+    __m512 fk = _mm512_cvtepi32_ps(k);
+    __m512 r = _mm512_fnmadd_ps(fk, _mm512_set1_ps(exp_ln2_hi), x);
+    r = _mm512_fnmadd_ps(fk, _mm512_set1_ps(exp_ln2_lo), r);
+    __m512 p = _mm512_set1_ps(exp_p[0]);
+    for (int j = 1; j < 6; ++j)
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p[j]));
+    p = _mm512_add_ps(_mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r), _mm512_set1_ps(1.f));
+    __m512i pow2k = _mm512_slli_epi32(_mm512_add_epi32(k, _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(pow2k));
+}
+
+AVX512_FN static void gaussian_exp_avx512(float *dst, const float *src, size_t src_stride, size_t n, float c0,
+                                          float c1)
+{
+    __m512 v0 = _mm512_set1_ps(c0), v1 = _mm512_set1_ps(c1);
+    __m512i idx = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+                                     _mm512_set1_epi32(int(src_stride)));
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? __mmask16(0xffff) : tail_mask_avx512(n - i);
+        const float *p = src + i * src_stride;
+        __m512 v = src_stride == 1 ? _mm512_maskz_loadu_ps(m, p)
+                                   : _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, idx, p, 4);
+        v = _mm512_min_ps(_mm512_fmadd_ps(v1, v, v0), _mm512_setzero_ps());
+        _mm512_mask_storeu_ps(dst + i, m, exp_avx512(v));
+    }
+}
+
+static const SimdKernels kernels_avx512 = {
+    "AVX-512",
+    cmul_avx512<false, false>,
+    cmul_avx512<true, false>,
+    cmul_avx512<false, true>,
+    cmul_avx512<true, true>,
+    cdiv_avx512,
+    axpby_avx512,
+    accumulate_avx512,
+    sqr_norm_avx512,
+    gaussian_exp_avx512,
+};
+
+#endif // SIMD_X86
+
+static const SimdKernels &select_kernels(const std::string &limit)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if ((limit.empty() || limit == "avx512") && __builtin_cpu_supports("avx512f"))
+        return kernels_avx512;
+    if ((limit.empty() || limit == "avx512" || limit == "avx2") && __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("fma"))
+        return kernels_avx2;
+    if (limit != "scalar" && __builtin_cpu_supports("sse3"))
+        return kernels_sse3;
+#endif
+    return kernels_scalar;
+}
+
+static const SimdKernels &select_kernels()
+{
+    bool unknown;
+    const SimdKernels &kernels = select_kernels(simd_limit(unknown));
+    if (unknown)
+        simd_limit_warning("complex kernels", kernels.name);
+    return kernels;
+}
+
+const SimdKernels &simd_kernels()
+{
+    static const SimdKernels &kernels = select_kernels();
+    return kernels;
+}
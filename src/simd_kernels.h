@@ -0,0 +1,41 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstddef>
+
+// Element-wise kernels over interleaved complex float data (re, im, re,
+// im, ...) as produced by the FFT backends. All counts are numbers of
+// complex elements. The implementation (scalar, SSE3, AVX2+FMA or
+// AVX-512) is selected once at run time according to the CPU features.
+// The selection can be overridden by the KCF_SIMD environment variable
+// (scalar, sse, avx2 or avx512, see simd_limit.h), which is useful for
+// benchmarking. Other values are reported on stderr and ignored.
+struct SimdKernels {
+    const char *name;
+
+    // dst = a * b
+    void (*cmul)(float *dst, const float *a, const float *b, size_t n);
+    // dst += a * b
+    void (*cmul_acc)(float *dst, const float *a, const float *b, size_t n);
+    // dst = a * conj(b)
+    void (*cmul_conj)(float *dst, const float *a, const float *b, size_t n);
+    // dst += a * conj(b)
+    void (*cmul_conj_acc)(float *dst, const float *a, const float *b, size_t n);
+    // dst = a / b
+    void (*cdiv)(float *dst, const float *a, const float *b, size_t n);
+    // dst = alpha * x + beta * y
+    void (*axpby)(float *dst, float alpha, const float *x, float beta, const float *y, size_t n);
+    // dst += a
+    void (*accumulate)(float *dst, const float *a, size_t n);
+    // returns sum of |a|^2
+    float (*sqr_norm)(const float *a, size_t n);
+
+    // Real valued kernel, dst[i] = exp(min(c0 + c1 * src[i * src_stride], 0))
+    // for i < n. The vectorised versions use a polynomial approximation of
+    // exp() with relative error below 2e-7.
+    void (*gaussian_exp)(float *dst, const float *src, size_t src_stride, size_t n, float c0, float c1);
+};
+
+const SimdKernels &simd_kernels();
+
+#endif // SIMD_KERNELS_H
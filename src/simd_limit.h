@@ -0,0 +1,27 @@
+#ifndef SIMD_LIMIT_H
+#define SIMD_LIMIT_H
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// The KCF_SIMD environment variable selects the instruction set of the
+// kernels chosen at run time (simd_kernels.h, gradient_simd.h), scalar,
+// sse, avx2 or avx512, if the CPU supports it. Returns its value, or an empty string if it
+// is not set or unknown, in which case unknown is set and the selection
+// should be reported with simd_limit_warning().
+inline std::string simd_limit(bool &unknown)
+{
+    const char *env = getenv("KCF_SIMD");
+    std::string limit = env ? env : "";
+    unknown = !limit.empty() && limit != "scalar" && limit != "sse" && limit != "avx2" && limit != "avx512";
+    return unknown ? std::string() : limit;
+}
+
+inline void simd_limit_warning(const char *kernels, const char *selected)
+{
+    std::cerr << "Warning: unknown KCF_SIMD value \"" << getenv("KCF_SIMD")
+              << "\" (expected scalar, sse, avx2 or avx512), using the " << selected << " " << kernels << std::endl;
+}
+
+#endif // SIMD_LIMIT_H
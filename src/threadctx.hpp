@@ -1,7 +1,6 @@
 #ifndef SCALE_VARS_HPP
 #define SCALE_VARS_HPP
 
-#include <future>
 #include "dynmem.hpp"
 
 #ifdef CUFFT
@@ -14,13 +13,26 @@ typedef int *cudaStream_t;
 #endif
 #endif
 
+// Scratch images of one feature extraction (see KCF_Tracker::get_features).
+// They keep their memory from frame to frame.
+struct FeatureBuffers {
+    cv::Mat gray_buf, rgb_buf; // storage of the sub-windows
+    cv::Mat gray_resized, rgb_resized;
+    // source cells and weights of the resampling from the feature pyramid
+    std::vector<int> pyramid_x, pyramid_y;
+    std::vector<float> pyramid_wx, pyramid_wy;
+};
+
 struct ThreadCtx {
   public:
-    ThreadCtx(cv::Size roi, uint num_of_feats, double scale, uint num_of_scales)
+    // All buffers are allocated from the arena, which must have at least
+    // arena_size() bytes available. The spectra are width_freq columns wide
+    // (see Fft::spectrum_width).
+    ThreadCtx(cv::Size roi, uint num_of_feats, double scale, uint num_of_scales, uint width_freq, Arena &arena)
         : scale(scale)
     {
-        this->xf_sqr_norm = DynMem(num_of_scales * sizeof(float));
-        this->yf_sqr_norm = DynMem(sizeof(float));
+        this->xf_sqr_norm = DynMem(num_of_scales * sizeof(float), arena);
+        this->yf_sqr_norm = DynMem(sizeof(float), arena);
 
         uint cells_size = roi.width * roi.height * sizeof(float);
 
@@ -28,24 +40,22 @@ struct ThreadCtx {
         CudaSafeCall(cudaStreamCreate(&this->stream));
 #endif
 
-#if defined(CUFFT) || defined(FFTW)
-        this->gauss_corr_res = DynMem(cells_size * num_of_scales);
-        this->data_features = DynMem(cells_size * num_of_feats);
-
-        uint width_freq = roi.width / 2 + 1;
-
-        this->in_all = cv::Mat(roi.height * num_of_scales, roi.width, CV_32F, this->gauss_corr_res.hostMem());
+        // windowed features of all scales, written by get_features()
+        this->data_features = DynMem(cells_size * num_of_feats, arena);
         this->fw_all = cv::Mat(roi.height * num_of_feats, roi.width, CV_32F, this->data_features.hostMem());
-#else
-        uint width_freq = roi.width;
-
-        this->in_all = cv::Mat(roi, CV_32F);
-#endif
 
-        this->data_i_features = DynMem(cells_size * num_of_feats);
-        this->data_i_1ch = DynMem(cells_size * num_of_scales);
+        this->gauss_corr_res = DynMem(cells_size * num_of_scales, arena);
+        this->in_all = cv::Mat(roi.height * num_of_scales, roi.width, CV_32F, this->gauss_corr_res.hostMem());
 
+#ifdef CUFFT
+        this->data_i_features = DynMem(cells_size * num_of_feats, arena);
         this->ifft2_res = cv::Mat(roi, CV_32FC(num_of_feats), this->data_i_features.hostMem());
+#else
+        // feature channels are summed before the inverse FFT (see gaussian_correlation)
+        this->data_i_features = DynMem(cells_size * num_of_scales, arena);
+        this->ifft2_res = cv::Mat(roi, CV_32FC(num_of_scales), this->data_i_features.hostMem());
+#endif
+        this->data_i_1ch = DynMem(cells_size * num_of_scales, arena);
         this->response = cv::Mat(roi, CV_32FC(num_of_scales), this->data_i_1ch.hostMem());
 
 #ifdef CUFFT
@@ -53,20 +63,42 @@ struct ThreadCtx {
         this->kzf.create(roi.height, width_freq, num_of_scales, this->stream);
         this->kf.create(roi.height, width_freq, num_of_scales, this->stream);
 #else
-        this->zf.create(roi.height, width_freq, num_of_feats, num_of_scales);
-        this->kzf.create(roi.height, width_freq, num_of_scales);
-        this->kf.create(roi.height, width_freq, num_of_scales);
+        this->zf.create(roi.height, width_freq, num_of_feats, num_of_scales, arena);
+        this->kzf.create(roi.height, width_freq, num_of_scales, 1, arena);
+        this->kf.create(roi.height, width_freq, num_of_scales, 1, arena);
+        this->xyf.create(roi.height, width_freq, num_of_scales, 1, arena);
 #endif
 
+        this->feature_buffers.resize(num_of_scales);
+
 #ifdef BIG_BATCH
-        if (num_of_scales > 1) {
-            this->max_responses.reserve(num_of_scales);
-            this->max_locs.reserve(num_of_scales);
-            this->response_maps.reserve(num_of_scales);
-        }
+        this->max_responses.resize(num_of_scales);
+        this->max_locs.resize(num_of_scales);
+        this->response_maps.resize(num_of_scales);
+        for (cv::Mat &map : this->response_maps)
+            map.create(roi, CV_32F);
 #endif
     }
     ThreadCtx(ThreadCtx &&) = default;
+
+    // Number of arena bytes needed by the constructor
+    static size_t arena_size(cv::Size roi, uint num_of_feats, uint num_of_scales, uint width_freq)
+    {
+        size_t cells_size = roi.width * roi.height * sizeof(float);
+        size_t size = dynmem_align(num_of_scales * sizeof(float)) + dynmem_align(sizeof(float));
+        size += dynmem_align(cells_size * num_of_feats);
+        size += dynmem_align(cells_size * num_of_scales);
+#ifdef CUFFT
+        size += dynmem_align(cells_size * num_of_feats);
+        (void)width_freq;
+#else
+        size += dynmem_align(cells_size * num_of_scales);
+        size += ComplexMat::arena_size(roi.height, width_freq, num_of_feats);
+        size += 3 * ComplexMat::arena_size(roi.height, width_freq, num_of_scales);
+#endif
+        size += dynmem_align(cells_size * num_of_scales);
+        return size;
+    }
     ~ThreadCtx()
     {
 #if  !defined(BIG_BATCH) && defined(CUFFT) && (defined(ASYNC) || defined(OPENMP))
@@ -75,18 +107,16 @@ struct ThreadCtx {
     }
 
     const double scale;
-#ifdef ASYNC
-    std::future<void> async_res;
-#endif
 
     DynMem xf_sqr_norm, yf_sqr_norm;
 
     cv::Mat in_all, fw_all, ifft2_res, response;
+    std::vector<FeatureBuffers> feature_buffers;
     ComplexMat zf, kzf, kf, xyf;
 
-    DynMem data_i_features, data_i_1ch;
+    DynMem data_i_features, data_i_1ch, data_features;
     // CuFFT and FFTW variables
-    DynMem gauss_corr_res, data_features;
+    DynMem gauss_corr_res;
 
     // CuFFT variables
     cudaStream_t stream = nullptr;
@@ -0,0 +1,165 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Fixed set of worker threads for fork/join parallel loops. The workers are
+// started once and wait for work between the loops, so no thread is created
+// while tracking. Waiting first spins for a short while, because the loops
+// of a tracker follow each other quickly, and then blocks.
+class ThreadPool {
+  public:
+    // Starts n_workers threads, the thread calling parallel_for() is an
+    // additional participant. With pin, worker i runs only on the (i + 1)-th
+    // CPU the process may run on (modulo their number), where supported.
+    // Pools pinned this way compete for the same CPUs, so pin only a pool
+    // that has the CPUs of the process for itself.
+    explicit ThreadPool(unsigned n_workers, bool pin = false)
+    {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+#else
+        (void)pin;
+#endif
+        workers.reserve(n_workers);
+        for (unsigned i = 0; i < n_workers; ++i) {
+            workers.emplace_back(&ThreadPool::worker, this, i + 1);
+#ifdef __linux__
+            if (!cpus.empty()) {
+                cpu_set_t cpu;
+                CPU_ZERO(&cpu);
+                CPU_SET(cpus[(i + 1) % cpus.size()], &cpu);
+                pthread_setaffinity_np(workers.back().native_handle(), sizeof(cpu), &cpu);
+            }
+#endif
+        }
+    }
+
+    ~ThreadPool()
+    {
+        stop.store(true, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation.fetch_add(1, std::memory_order_release);
+        }
+        start_cv.notify_all();
+        for (std::thread &t : workers)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Number of threads taking part in parallel_for()
+    unsigned size() const { return unsigned(workers.size()) + 1; }
+
+    // Calls fn(i) for i in [0, n) and returns when all the calls finished.
+    // Index i is always processed by the same thread, i % size(), where 0
+    // is the calling thread, so thread local buffers keep their size from
+    // loop to loop. It must not be called concurrently or from fn.
+    template <typename F> void parallel_for(unsigned n, F &fn)
+    {
+        if (n == 0)
+            return;
+        if (workers.empty() || n == 1) {
+            for (unsigned i = 0; i < n; ++i)
+                fn(i);
+            return;
+        }
+
+        job_fn = &call<F>;
+        job_arg = &fn;
+        job_size = n;
+        pending.store(unsigned(workers.size()), std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation.fetch_add(1, std::memory_order_release);
+        }
+        start_cv.notify_all();
+
+        for (unsigned i = 0; i < n; i += size())
+            fn(i);
+
+        for (unsigned spin = 0; pending.load(std::memory_order_acquire) != 0; ++spin) {
+            if (spin < spin_count) {
+                pause();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            done_cv.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+        }
+    }
+
+  private:
+    static const unsigned spin_count = 20000;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    std::atomic<unsigned> generation{0};
+    std::atomic<unsigned> pending{0};
+    std::atomic<bool> stop{false};
+
+    // current loop, valid while generation is unchanged
+    void (*job_fn)(void *, unsigned) = nullptr;
+    void *job_arg = nullptr;
+    unsigned job_size = 0;
+
+    // Tells the CPU that the thread is spinning, so that the other hardware
+    // thread of the core gets its execution units
+    static void pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    template <typename F> static void call(void *fn, unsigned i) { (*static_cast<F *>(fn))(i); }
+
+    void worker(unsigned id)
+    {
+        unsigned seen = 0;
+        while (true) {
+            unsigned spin = 0;
+            for (; generation.load(std::memory_order_acquire) == seen && spin < spin_count; ++spin)
+                pause();
+            if (generation.load(std::memory_order_acquire) == seen) {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [this, seen] { return generation.load(std::memory_order_acquire) != seen; });
+            }
+            seen = generation.load(std::memory_order_acquire);
+            if (stop.load(std::memory_order_relaxed))
+                return;
+
+            for (unsigned i = id; i < job_size; i += size())
+                job_fn(job_arg, i);
+
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done_cv.notify_one();
+            }
+        }
+    }
+};
+
+#endif // THREADPOOL_HPP
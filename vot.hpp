@@ -11,8 +11,16 @@
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
+#include "framecache.hpp"
+
 
 // Bounding box type
 /* format:
@@ -93,8 +101,17 @@ public:
 
         p_init_polygon = p;
 
-        p_images_stream.open(images.c_str());
-        if (!p_images_stream.is_open())
+        // images is a frame cache, a list of image files (*.txt) or a video
+        // file or capture device (number) for cv::VideoCapture
+        if (FrameCache::isFrameCache(images))
+            p_frame_cache.open(images);
+        else if (images.size() >= 4 && images.compare(images.size() - 4, 4, ".txt") == 0)
+            p_images_stream.open(images.c_str());
+        else if (!images.empty() && images.find_first_not_of("0123456789") == std::string::npos)
+            p_capture.open(atoi(images.c_str()));
+        else
+            p_capture.open(images);
+        if (!p_images_stream.is_open() && !p_frame_cache.isOpen() && !p_capture.isOpened())
             std::cerr << "Error loading image file " << images << "!" << std::endl;
 
         p_output_stream.open(ouput.c_str());
@@ -105,6 +122,13 @@ public:
 
     ~VOT()
     {
+        {
+            std::lock_guard<std::mutex> lock(p_mutex);
+            p_stop = true;
+        }
+        p_space_cv.notify_all();
+        for (std::thread &t : p_decoders)
+            t.join();
         p_images_stream.close();
         p_output_stream.close();
     }
@@ -148,25 +172,155 @@ public:
         return 1;
     }
 
+    // Decodes the following images in n_threads background threads, at most
+    // queue_size images ahead of getNextImage(), which then only takes the
+    // next decoded image. A video is always read by a single thread. It
+    // must be called before getNextImage() and getNextFileName() must not
+    // be used with it.
+    void startPrefetch(unsigned n_threads, unsigned queue_size = 4)
+    {
+        if (n_threads == 0 || !p_decoders.empty() || p_frame_cache.isOpen())
+            return;
+        if (p_capture.isOpened())
+            n_threads = 1;
+        p_slots.resize(std::max(queue_size, n_threads));
+        for (unsigned i = 0; i < n_threads; ++i)
+            p_decoders.emplace_back(&VOT::decoder, this);
+    }
+
+    // The pixels of the image passed in may be reused for a later frame,
+    // so the caller must not keep other references to them.
     inline int getNextImage(cv::Mat & img)
     {
-        if (p_images_stream.eof() || !p_images_stream.is_open())
+        if (p_frame_cache.isOpen()) {
+            // no decoding, just a header over the mapped file
+            if (p_next_get >= p_frame_cache.size())
                 return -1;
+            img = p_frame_cache.frame(p_next_get++);
+            p_decode_time = p_wait_time = 0.;
+            return 1;
+        }
 
-        std::string line;
-        std::getline (p_images_stream, line);
-    	if (line.empty() && p_images_stream.eof()) return -1;
-        img = cv::imread(line, CV_LOAD_IMAGE_COLOR);
+        auto start = std::chrono::steady_clock::now();
+        if (p_decoders.empty()) {
+            std::string line;
+            if (!p_capture.isOpened() && !read_image_name(line))
+                return -1;
+            if (!read_frame(line, img))
+                return -1;
+            p_decode_time = p_wait_time = elapsed_ms(start);
+            return 1;
+        }
 
+        std::unique_lock<std::mutex> lock(p_mutex);
+        Slot &slot = p_slots[p_next_get % p_slots.size()];
+        p_ready_cv.wait(lock, [this, &slot] { return slot.ready || p_next_get >= p_end; });
+        p_wait_time = elapsed_ms(start);
+        if (!slot.ready)
+            return -1;
+        // give the previous frame buffer back for reuse by the capture
+        std::swap(img, slot.img);
+        slot.ready = false;
+        p_decode_time = slot.decode_time;
+        ++p_next_get;
+        lock.unlock();
+        p_space_cv.notify_all();
         return 1;
     }
 
+    // Time in ms spent decoding the image returned by the last
+    // getNextImage() call, possibly in a background thread
+    double lastDecodeTime() const { return p_decode_time; }
+    // Time in ms the last getNextImage() call took, i.e. waited for the
+    // decoding when prefetching
+    double lastWaitTime() const { return p_wait_time; }
+
 private:
+    struct Slot {
+        cv::Mat img;
+        double decode_time = 0.;
+        bool ready = false;
+    };
+
+    static double elapsed_ms(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool read_image_name(std::string & line)
+    {
+        if (p_images_stream.eof() || !p_images_stream.is_open())
+            return false;
+        std::getline(p_images_stream, line);
+        return !(line.empty() && p_images_stream.eof());
+    }
+
+    // Decodes the image called name or reads the next video frame into img,
+    // whose buffer is reused by the capture if it has the right size
+    bool read_frame(const std::string & name, cv::Mat & img)
+    {
+        if (p_capture.isOpened())
+            return p_capture.read(img);
+        img = cv::imread(name, CV_LOAD_IMAGE_COLOR);
+        return true;
+    }
+
+    // Reads the images (image names) in order and decodes them into the
+    // slots. Image i goes to slot i % p_slots.size() once image
+    // i - p_slots.size() has been taken by getNextImage(). The slot then
+    // belongs to the decoder until it is marked ready.
+    void decoder()
+    {
+        std::unique_lock<std::mutex> lock(p_mutex);
+        while (true) {
+            p_space_cv.wait(lock, [this] {
+                return p_stop || p_next_read >= p_end || p_next_read < p_next_get + p_slots.size();
+            });
+            if (p_stop || p_next_read >= p_end)
+                return;
+
+            std::string line;
+            bool more = p_capture.isOpened() || read_image_name(line);
+            size_t index = p_next_read++;
+            Slot &slot = p_slots[index % p_slots.size()];
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            more = more && read_frame(line, slot.img);
+            double decode_time = elapsed_ms(start);
+
+            lock.lock();
+            if (!more) {
+                p_end = std::min(p_end, index);
+                p_ready_cv.notify_all();
+                p_space_cv.notify_all();
+                return;
+            }
+            slot.decode_time = decode_time;
+            slot.ready = true;
+            p_ready_cv.notify_all();
+        }
+    }
+
+
     std::string _images;
     VOTPolygon p_init_polygon;
     std::ifstream p_region_stream;
     std::ifstream p_images_stream;
     std::ofstream p_output_stream;
+    FrameCache p_frame_cache;
+    cv::VideoCapture p_capture;
+
+    double p_decode_time = 0., p_wait_time = 0.;
+
+    // prefetching, p_images_stream is read under p_mutex then
+    std::vector<std::thread> p_decoders;
+    std::vector<Slot> p_slots;
+    std::mutex p_mutex;
+    std::condition_variable p_ready_cv, p_space_cv;
+    size_t p_next_read = 0, p_next_get = 0;
+    size_t p_end = std::numeric_limits<size_t>::max();  // number of images, once known
+    bool p_stop = false;
 
 };
 